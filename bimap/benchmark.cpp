@@ -0,0 +1,395 @@
+// Микробенчмарки bimap с обоими индексами (intrusive::tree и intrusive::btree)
+// в сравнении с парой std::map и парой std::unordered_map.
+//
+// Сборка и запуск:
+//   g++ -std=c++20 -O2 -DNDEBUG -I bimap bimap/benchmark.cpp -o bimap-benchmark
+//   ./bimap-benchmark [--min-size N] [--max-size N] > results.json
+//
+// Размеры перебираются степенями десяти от --min-size (по умолчанию 1e3) до
+// --max-size (по умолчанию 1e7). Для каждого размера и распределения ключей
+// (random, sorted, reverse, zipf) меряются insert, find_left, find_left_batch
+// (только bimap, пакетами по 256 ключей), find_right,
+// at_left_or_default, lower_bound_left, upper_bound_right, erase_left,
+// полный обход и копирование. Результат -- JSON в stdout, прогресс -- в stderr.
+
+#include "bimap.h"
+#include "intrusive-btree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using key_type = std::uint64_t;
+
+// Биекция, задающая right по left, чтобы обе стороны были уникальны.
+key_type partner(key_type key) {
+  return key ^ 0x5555555555555555ull;
+}
+
+// Не дает компилятору выбросить результаты измеряемых операций.
+volatile key_type sink;
+
+// Прозрачный пакетный поиск принимает непрерывные диапазоны ключей другого
+// типа как есть, без ручной сборки std::span<const K>.
+using string_bimap = bimap<std::string, std::string, std::less<>, std::less<>>;
+static_assert(requires(const string_bimap& map, const std::vector<std::string_view>& keys, const char* const (&raw)[2],
+                       std::span<string_bimap::left_iterator> left_out,
+                       std::span<string_bimap::right_iterator> right_out) {
+  map.find_left_batch(keys, left_out);
+  map.find_right_batch(keys, right_out);
+  map.find_left_batch(raw, left_out);
+});
+
+template <typename Index>
+struct bimap_adapter {
+  using map_type = bimap<key_type, key_type, std::less<key_type>, std::less<key_type>,
+                         std::allocator<std::pair<key_type, key_type>>, Index>;
+
+  static constexpr const char* name =
+      std::is_same_v<Index, intrusive::btree_policy> ? "bimap (btree)" : "bimap";
+  static constexpr bool ordered = true;
+  static constexpr bool batched = true;
+  static constexpr std::size_t batch_size = 256;
+
+  bool insert(key_type left, key_type right) {
+    return map.insert(left, right) != map.end_left();
+  }
+
+  key_type find_left(key_type key) const {
+    auto it = map.find_left(key);
+    return it == map.end_left() ? 0 : *it.flip();
+  }
+
+  key_type find_right(key_type key) const {
+    auto it = map.find_right(key);
+    return it == map.end_right() ? 0 : *it.flip();
+  }
+
+  key_type find_left_batch(const std::vector<key_type>& keys) const {
+    key_type sum = 0;
+    std::vector<typename map_type::left_iterator> found(batch_size);
+    for (std::size_t first = 0; first < keys.size(); first += batch_size) {
+      std::size_t count = std::min(batch_size, keys.size() - first);
+      map.find_left_batch(std::span(keys).subspan(first, count), std::span(found).first(count));
+      for (std::size_t i = 0; i < count; i++) {
+        sum += found[i] == map.end_left() ? 0 : *found[i].flip();
+      }
+    }
+    return sum;
+  }
+
+  key_type at_left_or_default(key_type key) {
+    return map.at_left_or_default(key);
+  }
+
+  key_type lower_bound_left(key_type key) const {
+    auto it = map.lower_bound_left(key);
+    return it == map.end_left() ? 0 : *it;
+  }
+
+  key_type upper_bound_right(key_type key) const {
+    auto it = map.upper_bound_right(key);
+    return it == map.end_right() ? 0 : *it;
+  }
+
+  bool erase_left(key_type key) {
+    return map.erase_left(key);
+  }
+
+  key_type iterate() const {
+    key_type sum = 0;
+    for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+      sum += *it;
+    }
+    return sum;
+  }
+
+  std::size_t copy() const {
+    map_type temp(map);
+    return temp.size();
+  }
+
+  map_type map;
+};
+
+// Пара словарей в обе стороны с той же семантикой операций, что у bimap.
+template <template <typename...> typename Map>
+struct map_pair_adapter {
+  static constexpr bool batched = false;
+
+  bool insert(key_type left, key_type right) {
+    if (to_right.count(left) != 0 || to_left.count(right) != 0) {
+      return false;
+    }
+    to_right.emplace(left, right);
+    to_left.emplace(right, left);
+    return true;
+  }
+
+  key_type find_left(key_type key) const {
+    auto it = to_right.find(key);
+    return it == to_right.end() ? 0 : it->second;
+  }
+
+  key_type find_right(key_type key) const {
+    auto it = to_left.find(key);
+    return it == to_left.end() ? 0 : it->second;
+  }
+
+  key_type at_left_or_default(key_type key) {
+    auto it = to_right.find(key);
+    if (it != to_right.end()) {
+      return it->second;
+    }
+    auto def = to_left.find(key_type());
+    if (def == to_left.end()) {
+      insert(key, key_type());
+    } else {
+      to_right.erase(def->second);
+      def->second = key;
+      to_right.emplace(key, key_type());
+    }
+    return key_type();
+  }
+
+  bool erase_left(key_type key) {
+    auto it = to_right.find(key);
+    if (it == to_right.end()) {
+      return false;
+    }
+    to_left.erase(it->second);
+    to_right.erase(it);
+    return true;
+  }
+
+  key_type iterate() const {
+    key_type sum = 0;
+    for (const auto& [left, right] : to_right) {
+      sum += left;
+    }
+    return sum;
+  }
+
+  std::size_t copy() const {
+    map_pair_adapter temp(*this);
+    return temp.to_right.size();
+  }
+
+  Map<key_type, key_type> to_right;
+  Map<key_type, key_type> to_left;
+};
+
+struct std_map_adapter : map_pair_adapter<std::map> {
+  static constexpr const char* name = "std::map pair";
+  static constexpr bool ordered = true;
+
+  key_type lower_bound_left(key_type key) const {
+    auto it = to_right.lower_bound(key);
+    return it == to_right.end() ? 0 : it->first;
+  }
+
+  key_type upper_bound_right(key_type key) const {
+    auto it = to_left.upper_bound(key);
+    return it == to_left.end() ? 0 : it->first;
+  }
+};
+
+struct unordered_map_adapter : map_pair_adapter<std::unordered_map> {
+  static constexpr const char* name = "std::unordered_map pair";
+  static constexpr bool ordered = false;
+
+  key_type lower_bound_left(key_type) const {
+    return 0;
+  }
+
+  key_type upper_bound_right(key_type) const {
+    return 0;
+  }
+};
+
+// Последовательность ключей, в которой они вставляются и запрашиваются.
+std::vector<key_type> make_keys(const std::string& distribution, std::size_t size, std::mt19937_64& rng) {
+  std::vector<key_type> keys(size);
+  for (std::size_t i = 0; i < size; i++) {
+    keys[i] = (i + 1) * 16;
+  }
+  if (distribution == "random") {
+    std::shuffle(keys.begin(), keys.end(), rng);
+  } else if (distribution == "reverse") {
+    std::reverse(keys.begin(), keys.end());
+  } else if (distribution == "zipf") {
+    // Ключ ранга r выбирается с вероятностью, пропорциональной 1 / r:
+    // горячие ключи повторяются, повторные вставки отклоняются.
+    std::shuffle(keys.begin(), keys.end(), rng);
+    std::vector<double> cdf(size);
+    double total = 0;
+    for (std::size_t i = 0; i < size; i++) {
+      total += 1.0 / static_cast<double>(i + 1);
+      cdf[i] = total;
+    }
+    std::uniform_real_distribution<double> uniform(0, total);
+    std::vector<key_type> sampled(size);
+    for (std::size_t i = 0; i < size; i++) {
+      std::size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+      sampled[i] = keys[std::min(rank, size - 1)];
+    }
+    keys = std::move(sampled);
+  }
+  return keys;
+}
+
+struct result {
+  std::string container;
+  std::string operation;
+  std::string distribution;
+  std::size_t size;
+  std::size_t ops;
+  double total_ns;
+};
+
+template <typename F>
+double measure(F&& body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  auto finish = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(finish - start).count();
+}
+
+template <typename Adapter>
+void run_container(const std::string& distribution, const std::vector<key_type>& keys, std::vector<result>& results) {
+  std::size_t size = keys.size();
+  auto record = [&](const char* operation, std::size_t ops, double ns) {
+    results.push_back({Adapter::name, operation, distribution, size, ops, ns});
+    std::fprintf(stderr, "%-24s %-20s %-8s %9zu %10.1f ns/op\n", Adapter::name, operation, distribution.c_str(), size,
+                 ops == 0 ? 0.0 : ns / static_cast<double>(ops));
+  };
+
+  Adapter adapter;
+  record("insert", size, measure([&] {
+           for (key_type key : keys) {
+             adapter.insert(key, partner(key));
+           }
+         }));
+  record("find_left", size, measure([&] {
+           key_type sum = 0;
+           for (key_type key : keys) {
+             sum += adapter.find_left(key);
+           }
+           sink = sum;
+         }));
+  if constexpr (Adapter::batched) {
+    record("find_left_batch", size, measure([&] { sink = adapter.find_left_batch(keys); }));
+  }
+  record("find_right", size, measure([&] {
+           key_type sum = 0;
+           for (key_type key : keys) {
+             sum += adapter.find_right(partner(key));
+           }
+           sink = sum;
+         }));
+  if constexpr (Adapter::ordered) {
+    record("lower_bound_left", size, measure([&] {
+             key_type sum = 0;
+             for (key_type key : keys) {
+               sum += adapter.lower_bound_left(key + 1);
+             }
+             sink = sum;
+           }));
+    record("upper_bound_right", size, measure([&] {
+             key_type sum = 0;
+             for (key_type key : keys) {
+               sum += adapter.upper_bound_right(partner(key));
+             }
+             sink = sum;
+           }));
+  }
+  record("iterate", size, measure([&] { sink = adapter.iterate(); }));
+  record("copy", size, measure([&] { sink = adapter.copy(); }));
+  // Половина запросов -- отсутствующие ключи: они перевешивают пару
+  // с дефолтным right на себя.
+  record("at_left_or_default", size, measure([&] {
+           key_type sum = 0;
+           for (std::size_t i = 0; i < keys.size(); i++) {
+             sum += adapter.at_left_or_default(i % 2 == 0 ? keys[i] : keys[i] + 1);
+           }
+           sink = sum;
+         }));
+  record("erase_left", size, measure([&] {
+           std::size_t erased = 0;
+           for (key_type key : keys) {
+             erased += adapter.erase_left(key);
+           }
+           sink = erased;
+         }));
+}
+
+void print_json(const std::vector<result>& results) {
+  std::printf("{\n  \"benchmarks\": [\n");
+  for (std::size_t i = 0; i < results.size(); i++) {
+    const result& cur = results[i];
+    std::printf("    {\"container\": \"%s\", \"operation\": \"%s\", \"distribution\": \"%s\", \"size\": %zu, "
+                "\"ops\": %zu, \"total_ns\": %.0f, \"ns_per_op\": %.3f}%s\n",
+                cur.container.c_str(), cur.operation.c_str(), cur.distribution.c_str(), cur.size, cur.ops,
+                cur.total_ns, cur.ops == 0 ? 0.0 : cur.total_ns / static_cast<double>(cur.ops),
+                i + 1 == results.size() ? "" : ",");
+  }
+  std::printf("  ]\n}\n");
+}
+
+std::optional<std::size_t> parse_size(const char* arg) {
+  char* end = nullptr;
+  double value = std::strtod(arg, &end);
+  if (end == arg || *end != '\0' || value < 1) {
+    return std::nullopt;
+  }
+  return static_cast<std::size_t>(value);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  std::size_t min_size = 1000;
+  std::size_t max_size = 10000000;
+  for (int i = 1; i < argc; i++) {
+    std::optional<std::size_t> value = i + 1 < argc ? parse_size(argv[i + 1]) : std::nullopt;
+    if (std::strcmp(argv[i], "--min-size") == 0 && value) {
+      min_size = *value;
+      i++;
+    } else if (std::strcmp(argv[i], "--max-size") == 0 && value) {
+      max_size = *value;
+      i++;
+    } else {
+      std::fprintf(stderr, "usage: %s [--min-size N] [--max-size N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<result> results;
+  for (std::size_t size = min_size; size <= max_size; size *= 10) {
+    for (const char* distribution : {"random", "sorted", "reverse", "zipf"}) {
+      std::mt19937_64 rng(size);
+      std::vector<key_type> keys = make_keys(distribution, size, rng);
+      run_container<bimap_adapter<intrusive::rb_tree_policy>>(distribution, keys, results);
+      run_container<bimap_adapter<intrusive::btree_policy>>(distribution, keys, results);
+      run_container<std_map_adapter>(distribution, keys, results);
+      run_container<unordered_map_adapter>(distribution, keys, results);
+    }
+  }
+  print_json(results);
+  return 0;
+}
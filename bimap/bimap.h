@@ -2,11 +2,34 @@
 
 #include "intrusive-tree.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
-
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Снимок bimap, который возвращает bimap::stats.
+struct bimap_stats {
+  intrusive::tree_stats left;
+  intrusive::tree_stats right;
+  // Узлы пар, выделенные и освобожденные самой bimap. Узлы, которые
+  // освободил node_handle, сюда не попадают.
+  std::uint64_t allocations = 0;
+  std::uint64_t deallocations = 0;
+};
+
+// Index -- политика, задающая деревья обеих сторон: intrusive::rb_tree_policy
+// (красно-черные деревья, по умолчанию) или intrusive::btree_policy из
+// intrusive-btree.h (B+-деревья, быстрее поиск на больших bimap).
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
+          typename CompareRight = std::less<Right>, typename Allocator = std::allocator<std::pair<Left, Right>>,
+          typename Index = intrusive::rb_tree_policy>
 class bimap {
 public:
   using left_t = Left;
@@ -18,6 +41,12 @@ private:
   template <typename>
   class universal_iterator;
 
+  template <typename Compare>
+  static constexpr bool is_transparent = requires { typename Compare::is_transparent; };
+
+  template <typename Tag>
+  using element = typename Index::template element<Tag>;
+
   template <typename ret_type, typename inp_type>
   class getter {
   public:
@@ -27,7 +56,7 @@ private:
   };
 
   template <typename Tag>
-  struct template_node : intrusive::tree_element<Tag> {
+  struct template_node : element<Tag> {
     using data_type = std::conditional_t<std::is_same_v<Tag, left>, left_t, right_t>;
 
     template_node(const data_type& inp) : dec(inp) {}
@@ -38,15 +67,16 @@ private:
     using friend_tag = std::conditional_t<std::is_same_v<Tag, left>, right, left>;
     using iterator = universal_iterator<template_node>;
     using friend_name = template_node<friend_tag>;
-    using tree_type = intrusive::tree<data_type, template_node, getter<data_type, template_node>, Tag,
-                                      std::conditional_t<std::is_same_v<Tag, left>, CompareLeft, CompareRight>>;
+    using tree_type = typename Index::template tree_type<
+        data_type, template_node, getter<data_type, template_node>, Tag,
+        std::conditional_t<std::is_same_v<Tag, left>, CompareLeft, CompareRight>, Allocator>;
     data_type dec;
   };
 
   using left_node = template_node<left>;
   using right_node = template_node<right>;
 
-  struct linking_node : public intrusive::tree_element<left>, intrusive::tree_element<right> {};
+  struct linking_node : public element<left>, element<right> {};
 
   struct data_node : left_node, right_node {
     explicit data_node(const Left& dec1, const Right& dec2) : left_node(dec1), right_node(dec2) {}
@@ -60,10 +90,13 @@ private:
     ~data_node() = default;
   };
 
+  using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<data_node>;
+  using node_alloc_traits = std::allocator_traits<node_allocator>;
+
   template <typename Iter_Type>
   class universal_iterator {
   private:
-    template <typename, typename, typename, typename>
+    template <typename, typename, typename, typename, typename, typename>
     friend class bimap;
     template <typename>
     friend class universal_iterator;
@@ -110,8 +143,8 @@ private:
     typename Iter_Type::friend_name::iterator flip() const {
       if (cur_node.is_end()) {
         return typename Iter_Type::friend_name::iterator(
-            static_cast<intrusive::tree_element<typename Iter_Type::friend_tag>*>(static_cast<linking_node*>(
-                const_cast<intrusive::tree_element<typename Iter_Type::data_tag>*>(cur_node.get_by_element()))));
+            static_cast<element<typename Iter_Type::friend_tag>*>(static_cast<linking_node*>(
+                const_cast<element<typename Iter_Type::data_tag>*>(cur_node.get_by_element()))));
       }
       return typename Iter_Type::friend_name::iterator(
           static_cast<typename Iter_Type::friend_name*>(static_cast<data_node*>(cur_node.operator->())));
@@ -128,7 +161,7 @@ private:
   private:
     using tree_iterator = typename Iter_Type::tree_type::iterator;
 
-    universal_iterator(intrusive::tree_element<typename Iter_Type::data_tag>* inp) : cur_node(tree_iterator(inp)) {}
+    universal_iterator(element<typename Iter_Type::data_tag>* inp) : cur_node(tree_iterator(inp)) {}
 
     universal_iterator(tree_iterator inp) : cur_node(inp) {}
 
@@ -137,33 +170,133 @@ private:
 
 public:
   using node_t = data_node;
+  using allocator_type = Allocator;
 
   using right_iterator = universal_iterator<right_node>;
 
   using left_iterator = universal_iterator<left_node>;
 
+  // Пара, извлеченная из bimap вместе со своим узлом (как node handle у
+  // std::map). Ее можно изменить и вставить в этот же или в другой bimap
+  // без выделения памяти и копирования ключей. Пустой node_handle ничего не
+  // хранит; непустой при уничтожении освобождает узел.
+  class node_handle {
+    template <typename, typename, typename, typename, typename, typename>
+    friend class bimap;
+
+  public:
+    node_handle() = default;
+
+    node_handle(node_handle&& other) noexcept : alloc(std::move(other.alloc)), node(std::exchange(other.node, nullptr)) {
+      other.alloc.reset();
+    }
+
+    node_handle& operator=(node_handle&& other) noexcept {
+      if (this != &other) {
+        reset();
+        alloc = std::move(other.alloc);
+        node = std::exchange(other.node, nullptr);
+        other.alloc.reset();
+      }
+      return *this;
+    }
+
+    node_handle(const node_handle&) = delete;
+    node_handle& operator=(const node_handle&) = delete;
+
+    ~node_handle() {
+      reset();
+    }
+
+    bool empty() const noexcept {
+      return node == nullptr;
+    }
+
+    explicit operator bool() const noexcept {
+      return !empty();
+    }
+
+    // Ключи пары. Для пустого node_handle вызывать нельзя.
+    left_t& left() const noexcept {
+      return static_cast<left_node*>(node)->dec;
+    }
+
+    right_t& right() const noexcept {
+      return static_cast<right_node*>(node)->dec;
+    }
+
+    allocator_type get_allocator() const {
+      return allocator_type(*alloc);
+    }
+
+  private:
+    node_handle(const node_allocator& alloc, data_node* node) : alloc(alloc), node(node) {}
+
+    void reset() noexcept {
+      if (node != nullptr) {
+        node_alloc_traits::destroy(*alloc, node);
+        node_alloc_traits::deallocate(*alloc, node, 1);
+        node = nullptr;
+      }
+      alloc.reset();
+    }
+
+    std::optional<node_allocator> alloc;
+    data_node* node{nullptr};
+  };
+
   // Создает bimap, не содержащий ни одной пары.
-  bimap(CompareLeft compare_left = CompareLeft(), CompareRight compare_right = CompareRight())
-      : sentinel(),
-        left_tree(static_cast<intrusive::tree_element<left>*>(&sentinel), std::move(compare_left)),
-        right_tree(static_cast<intrusive::tree_element<right>*>(&sentinel), std::move(compare_right)) {}
+  bimap(CompareLeft compare_left = CompareLeft(), CompareRight compare_right = CompareRight(),
+        const Allocator& allocator = Allocator())
+      : alloc(allocator),
+        sentinel(),
+        left_tree(static_cast<element<left>*>(&sentinel), std::move(compare_left), allocator),
+        right_tree(static_cast<element<right>*>(&sentinel), std::move(compare_right), allocator) {}
 
   // Конструкторы от других и присваивания
+  // Копирование строит обе стороны сразу сбалансированными: левую за O(n)
+  // в порядке other, правую -- один раз отсортировав узлы по right.
   bimap(const bimap& other)
-      : left_tree(&sentinel, CompareLeft(other.left_tree.get_comp())),
-        right_tree(&sentinel, CompareRight(other.right_tree.get_comp())) {
+      : alloc(node_alloc_traits::select_on_container_copy_construction(other.alloc)),
+        left_tree(&sentinel, CompareLeft(other.left_tree.get_comp()), Allocator(alloc)),
+        right_tree(&sentinel, CompareRight(other.right_tree.get_comp()), Allocator(alloc)) {
+    std::vector<data_node*> nodes;
     try {
+      nodes.reserve(other.size());
       for (auto cur_node = other.begin_left(); cur_node != other.end_left(); cur_node++) {
-        insert(*cur_node, *cur_node.flip());
+        nodes.push_back(create_node(*cur_node, *cur_node.flip()));
       }
     } catch (...) {
-      erase_left(begin_left(), end_left());
+      destroy_nodes(nodes);
       throw;
     }
+    build_from_nodes(nodes);
+  }
+
+  // Создает bimap из пар (left, right), упорядоченных по строгому
+  // возрастанию left, без вставки по одной: за O(n) по левой стороне и
+  // O(n log n) сравнений right. Если left не возрастают строго или среди right
+  // есть повторы, бросает std::invalid_argument.
+  template <typename InputIt>
+  static bimap from_sorted(InputIt first, InputIt last, CompareLeft compare_left = CompareLeft(),
+                           CompareRight compare_right = CompareRight(), const Allocator& allocator = Allocator()) {
+    bimap res(std::move(compare_left), std::move(compare_right), allocator);
+    std::vector<data_node*> nodes;
+    try {
+      for (; first != last; ++first) {
+        nodes.push_back(res.create_node((*first).first, (*first).second));
+      }
+    } catch (...) {
+      res.destroy_nodes(nodes);
+      throw;
+    }
+    res.build_from_nodes(nodes);
+    return res;
   }
 
   bimap(bimap&& other) noexcept
       : elements_num(std::move(other.elements_num)),
+        alloc(std::move(other.alloc)),
         sentinel(),
         left_tree(&sentinel, std::move(other.left_tree)),
         right_tree(&sentinel, std::move(other.right_tree)) {
@@ -186,12 +319,17 @@ public:
   // Деструктор. Вызывается при удалении объектов bimap.
   // Инвалидирует все итераторы ссылающиеся на элементы этого bimap
   // (включая итераторы ссылающиеся на элементы следующие за последними).
+  // Разбирает деревья за O(n) без перебалансировок.
   ~bimap() {
-    erase_left(begin_left(), end_left());
+    right_tree.clear([](right_node*) noexcept {});
+    left_tree.clear([this](left_node* node) noexcept { destroy_node(static_cast<data_node*>(node)); });
   }
 
   friend void swap(bimap& lhs, bimap& rhs) {
     std::swap(lhs.elements_num, rhs.elements_num);
+    if constexpr (node_alloc_traits::propagate_on_container_swap::value) {
+      std::swap(lhs.alloc, rhs.alloc);
+    }
     lhs.left_tree.swap(rhs.left_tree);
     lhs.right_tree.swap(rhs.right_tree);
   }
@@ -201,25 +339,117 @@ public:
   // производится и возвращается end_left().
   template <typename L = Left, typename R = Right>
   left_iterator insert(L&& left, R&& right) {
-    auto res = left_tree.begin();
-    if (find_right(right) == end_right() && find_left(left) == end_left()) {
-      auto* to_ins = new data_node(std::forward<L>(left), std::forward<R>(right));
-      try {
-        res = left_tree.insert(static_cast<left_node*>(to_ins));
+    auto left_pos = left_tree.find_position(left);
+    if (left_pos.occupied()) {
+      return end_left();
+    }
+    auto right_pos = right_tree.find_position(right);
+    if (right_pos.occupied()) {
+      return end_left();
+    }
+    return insert_at(left_pos, right_pos, std::forward<L>(left), std::forward<R>(right));
+  }
+
+  // Вставка с подсказками: hint_left и hint_right -- итераторы на элементы,
+  // перед которыми должны оказаться left и right (как у std::map::emplace_hint).
+  // При верных подсказках (например, при вставке по возрастанию с end_left()
+  // и end_right()) место ищется за O(1) сравнений.
+  template <typename L = Left, typename R = Right>
+  left_iterator insert(left_iterator hint_left, right_iterator hint_right, L&& left, R&& right) {
+    auto left_pos = left_tree.find_position(hint_left.cur_node, left);
+    if (left_pos.occupied()) {
+      return end_left();
+    }
+    auto right_pos = right_tree.find_position(hint_right.cur_node, right);
+    if (right_pos.occupied()) {
+      return end_left();
+    }
+    return insert_at(left_pos, right_pos, std::forward<L>(left), std::forward<R>(right));
+  }
+
+  // Вставляет пару из nh, переиспользуя ее узел. Если такой left или такой
+  // right уже присутствуют, возвращает end_left() и оставляет пару в nh,
+  // иначе nh становится пустым. Если аллокатор nh не равен аллокатору bimap,
+  // узел создается заново из ключей nh. Пустой nh ничего не вставляет.
+  left_iterator insert(node_handle&& nh) {
+    if (nh.empty()) {
+      return end_left();
+    }
+    auto left_pos = left_tree.find_position(nh.left());
+    if (left_pos.occupied()) {
+      return end_left();
+    }
+    auto right_pos = right_tree.find_position(nh.right());
+    if (right_pos.occupied()) {
+      return end_left();
+    }
+    if (*nh.alloc != alloc) {
+      auto res = insert_at(left_pos, right_pos, std::move(nh.left()), std::move(nh.right()));
+      nh.reset();
+      return res;
+    }
+    auto res = attach(left_pos, right_pos, nh.node);
+    nh.node = nullptr;
+    return res;
+  }
+
+  // Извлекает пару из bimap вместе с узлом, не освобождая его. Инвалидирует
+  // итераторы на эту пару. Извлечение по ключу возвращает пустой
+  // node_handle, если ключ не найден.
+  node_handle extract_left(left_iterator it) {
+    return node_handle(alloc, detach(it));
+  }
+
+  node_handle extract_left(const left_t& left) {
+    auto it = find_left(left);
+    return it == end_left() ? node_handle() : extract_left(it);
+  }
+
+  node_handle extract_right(right_iterator it) {
+    return node_handle(alloc, detach(it.flip()));
+  }
+
+  node_handle extract_right(const right_t& right) {
+    auto it = find_right(right);
+    return it == end_right() ? node_handle() : extract_right(it);
+  }
+
+  // Переносит в bimap все пары other, у которых ни left, ни right не
+  // встречаются в *this. Узлы перевешиваются без выделения памяти и
+  // копирования ключей; конфликтующие пары остаются в other. Если аллокаторы
+  // не равны, перенесенные пары копируются в новые узлы. Если вставка
+  // бросает исключение, переносимая пара уничтожается.
+  void merge(bimap& other) {
+    if (&other == this) {
+      return;
+    }
+    for (auto it = other.begin_left(); it != other.end_left();) {
+      auto cur = it++;
+      auto left_pos = left_tree.find_position(*cur);
+      if (left_pos.occupied()) {
+        continue;
+      }
+      auto right_pos = right_tree.find_position(*cur.flip());
+      if (right_pos.occupied()) {
+        continue;
+      }
+      if (alloc == other.alloc) {
+        data_node* node = other.detach(cur);
         try {
-          right_tree.insert(static_cast<right_node*>(to_ins));
+          attach(left_pos, right_pos, node);
         } catch (...) {
-          left_tree.erase(res);
+          other.destroy_node(node);
           throw;
         }
-      } catch (...) {
-        delete to_ins;
-        throw;
+      } else {
+        insert_at(left_pos, right_pos, *cur, *cur.flip());
+        other.erase_left(cur);
       }
-      elements_num++;
-      return left_iterator(res);
     }
-    return end_left();
+  }
+
+  void merge(bimap&& other) {
+    merge(other);
   }
 
   // Удаляет элемент и соответствующий ему парный.
@@ -230,7 +460,7 @@ public:
   left_iterator erase_left(left_iterator it) {
     right_tree.erase(it.flip().cur_node);
     auto old = it++;
-    delete static_cast<data_node*>(left_tree.erase(old.cur_node));
+    destroy_node(static_cast<data_node*>(left_tree.erase(old.cur_node)));
     elements_num--;
     return left_iterator(it.cur_node);
   }
@@ -238,43 +468,51 @@ public:
   // Аналогично erase, но по ключу, удаляет элемент если он присутствует, иначе
   // не делает ничего Возвращает была ли пара удалена
   bool erase_left(const left_t& left) {
-    auto temp = find_left(left);
-    if (temp == end_left()) {
-      return false;
-    }
-    erase_left(temp);
-    return true;
+    return erase_found(find_left(left));
   }
 
   right_iterator erase_right(right_iterator it) {
     left_tree.erase(it.flip().cur_node);
     auto old = it++;
-    delete static_cast<data_node*>(right_tree.erase(old.cur_node));
+    destroy_node(static_cast<data_node*>(right_tree.erase(old.cur_node)));
     elements_num--;
     return right_iterator(it.cur_node);
   }
 
   bool erase_right(const right_t& right) {
-    auto temp = find_right(right);
-    if (temp == end_right()) {
-      return false;
-    }
-    erase_right(temp);
-    return true;
+    return erase_found(find_right(right));
   }
 
   // erase от ренжа, удаляет [first, last), возвращает итератор на последний
   // элемент за удаленной последовательностью
+  // Диапазон вырезается из своего дерева целиком за O(log^2 n), и только в
+  // дереве другой стороны пары удаляются по одной, всего O(k log n).
   left_iterator erase_left(left_iterator first, left_iterator last) {
-    for (auto iter = first; iter != last; iter = erase_left(iter)) {}
+    erase_range(left_tree, right_tree, first, last);
     return last;
   }
 
   right_iterator erase_right(right_iterator first, right_iterator last) {
-    for (auto iter = first; iter != last; iter = erase_right(iter)) {}
+    erase_range(right_tree, left_tree, first, last);
     return last;
   }
 
+  // Удаляет все пары, у которых left лежит в полуинтервале [lo, hi), и
+  // возвращает их количество.
+  std::size_t erase_left_range(const left_t& lo, const left_t& hi) {
+    if (!left_tree.get_comp()(lo, hi)) {
+      return 0;
+    }
+    return erase_range(left_tree, right_tree, lower_bound_left(lo), lower_bound_left(hi));
+  }
+
+  std::size_t erase_right_range(const right_t& lo, const right_t& hi) {
+    if (!right_tree.get_comp()(lo, hi)) {
+      return 0;
+    }
+    return erase_range(right_tree, left_tree, lower_bound_right(lo), lower_bound_right(hi));
+  }
+
   // Возвращает итератор по элементу. Если не найден - соответствующий end()
   left_iterator find_left(const left_t& left) const {
     return left_tree.find(left);
@@ -284,22 +522,27 @@ public:
     return right_tree.find(right);
   }
 
+  // Пакетный поиск: out[i] -- итератор на keys[i] или end_left(). Спуски
+  // по дереву для разных ключей идут вперемешку, и их промахи кеша
+  // перекрываются, поэтому на bimap, не влезающих в кеш, это в несколько раз
+  // быстрее find_left в цикле. Если размеры keys и out различаются, бросает
+  // std::invalid_argument.
+  void find_left_batch(std::span<const left_t> keys, std::span<left_iterator> out) const {
+    find_batch(left_tree, keys, out);
+  }
+
+  void find_right_batch(std::span<const right_t> keys, std::span<right_iterator> out) const {
+    find_batch(right_tree, keys, out);
+  }
+
   // Возвращает противоположный элемент по элементу
   // Если элемента не существует -- бросает std::out_of_range
   const right_t& at_left(const left_t& key) const {
-    auto res = find_left(key).flip();
-    if (res == end_right()) {
-      throw std::out_of_range("key not found");
-    }
-    return *res;
+    return at_impl(find_left(key));
   }
 
   const left_t& at_right(const right_t& key) const {
-    auto res = find_right(key).flip();
-    if (res == end_left()) {
-      throw std::out_of_range("key not found");
-    }
-    return *res;
+    return at_impl(find_right(key));
   }
 
   // Возвращает противоположный элемент по элементу
@@ -316,11 +559,7 @@ public:
       if (res == end_right()) {
         res = insert(key, Right()).flip();
       } else {
-        auto to_change = static_cast<data_node*>(right_tree.get_node(res.cur_node));
-        left_tree.erase(res.flip().cur_node);
-        static_cast<left_node*>(to_change)->dec.~Left();
-        new (&static_cast<left_node*>(to_change)->dec) Left(key);
-        left_tree.insert(to_change);
+        replace_left(res.flip(), key);
       }
     }
     return *res;
@@ -335,16 +574,30 @@ public:
       if (res == end_left()) {
         res = insert(Left(), key);
       } else {
-        auto to_change = static_cast<data_node*>(left_tree.get_node(res.cur_node));
-        right_tree.erase(res.flip().cur_node);
-        static_cast<right_node*>(to_change)->dec.~Right();
-        new (&static_cast<right_node*>(to_change)->dec) Right(key);
-        right_tree.insert(to_change);
+        replace_right(res.flip(), key);
       }
     }
     return *res;
   }
 
+  // Меняет left у пары, на которую указывает it, на new_left, сохраняя ее
+  // узел и right. Перестраивается только левое дерево. Если new_left уже
+  // есть у другой пары, ничего не меняет и возвращает false. Итераторы на
+  // пару остаются валидными. Старый ключ уничтожается, а новый
+  // конструируется на его месте перемещением; ключам, перемещение которых
+  // может бросить исключение, нужно вместо этого присваивание перемещением.
+  // Если оно или сравнение бросает исключение и узел нельзя вернуть на
+  // место, пара удаляется.
+  template <typename L = Left>
+  bool replace_left(left_iterator it, L&& new_left) {
+    return replace_key(left_tree, it, Left(std::forward<L>(new_left)));
+  }
+
+  template <typename R = Right>
+  bool replace_right(right_iterator it, R&& new_right) {
+    return replace_key(right_tree, it, Right(std::forward<R>(new_right)));
+  }
+
   // lower и upper bound'ы по каждой стороне
   // Возвращают итераторы на соответствующие элементы
   // Смотри std::lower_bound, std::upper_bound.
@@ -364,6 +617,115 @@ public:
     return right_iterator(right_tree.upper_bound(left));
   }
 
+  // Порядковые статистики, все за O(log n).
+  // nth_left(i) -- итератор на i-й (с нуля) по порядку left, end_left(), если
+  // i >= size(). rank_left(key) -- количество left, строго меньших key.
+  // count_left(lo, hi) -- количество left из полуинтервала [lo, hi).
+  left_iterator nth_left(std::size_t index) const {
+    return left_iterator(left_tree.select(index));
+  }
+
+  right_iterator nth_right(std::size_t index) const {
+    return right_iterator(right_tree.select(index));
+  }
+
+  std::size_t rank_left(const left_t& key) const {
+    return left_tree.rank(key);
+  }
+
+  std::size_t rank_right(const right_t& key) const {
+    return right_tree.rank(key);
+  }
+
+  std::size_t count_left(const left_t& lo, const left_t& hi) const {
+    std::size_t lo_rank = left_tree.rank(lo);
+    std::size_t hi_rank = left_tree.rank(hi);
+    return hi_rank > lo_rank ? hi_rank - lo_rank : 0;
+  }
+
+  std::size_t count_right(const right_t& lo, const right_t& hi) const {
+    std::size_t lo_rank = right_tree.rank(lo);
+    std::size_t hi_rank = right_tree.rank(hi);
+    return hi_rank > lo_rank ? hi_rank - lo_rank : 0;
+  }
+
+  // Поиск по ключам другого типа без создания временных left_t/right_t.
+  // Доступен, если соответствующий компаратор прозрачный (объявляет
+  // is_transparent, как std::less<>), и ведет себя как перегрузки выше.
+  template <typename K>
+    requires(is_transparent<CompareLeft>)
+  left_iterator find_left(const K& left) const {
+    return left_tree.find(left);
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareRight>)
+  right_iterator find_right(const K& right) const {
+    return right_tree.find(right);
+  }
+
+  // keys -- любой непрерывный диапазон: std::vector<std::string_view>,
+  // массив, std::span.
+  template <std::ranges::contiguous_range Keys>
+    requires(std::ranges::sized_range<Keys> && is_transparent<CompareLeft>)
+  void find_left_batch(const Keys& keys, std::span<left_iterator> out) const {
+    find_batch(left_tree, std::span(std::ranges::data(keys), std::ranges::size(keys)), out);
+  }
+
+  template <std::ranges::contiguous_range Keys>
+    requires(std::ranges::sized_range<Keys> && is_transparent<CompareRight>)
+  void find_right_batch(const Keys& keys, std::span<right_iterator> out) const {
+    find_batch(right_tree, std::span(std::ranges::data(keys), std::ranges::size(keys)), out);
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareLeft>)
+  const right_t& at_left(const K& key) const {
+    return at_impl(find_left(key));
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareRight>)
+  const left_t& at_right(const K& key) const {
+    return at_impl(find_right(key));
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareLeft>)
+  bool erase_left(const K& left) {
+    return erase_found(find_left(left));
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareRight>)
+  bool erase_right(const K& right) {
+    return erase_found(find_right(right));
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareLeft>)
+  left_iterator lower_bound_left(const K& left) const {
+    return left_iterator(left_tree.lower_bound(left));
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareLeft>)
+  left_iterator upper_bound_left(const K& left) const {
+    return left_iterator(left_tree.upper_bound(left));
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareRight>)
+  right_iterator lower_bound_right(const K& right) const {
+    return right_iterator(right_tree.lower_bound(right));
+  }
+
+  template <typename K>
+    requires(is_transparent<CompareRight>)
+  right_iterator upper_bound_right(const K& right) const {
+    return right_iterator(right_tree.upper_bound(right));
+  }
+
   // Возващает итератор на минимальный по порядку left.
   left_iterator begin_left() const {
     return left_iterator(left_tree.begin());
@@ -384,6 +746,10 @@ public:
     return right_iterator(right_tree.end());
   }
 
+  allocator_type get_allocator() const {
+    return allocator_type(alloc);
+  }
+
   // Проверка на пустоту
   bool empty() const {
     return left_tree.empty();
@@ -394,6 +760,13 @@ public:
     return elements_num;
   }
 
+  // Форма деревьев обеих сторон считается за O(n). Счетчики сравнений,
+  // спусков и выделений копятся, только если определен BIMAP_STATS
+  // (см. intrusive-stats.h), иначе они нулевые и ничего не стоят.
+  bimap_stats stats() const noexcept {
+    return {left_tree.stats(), right_tree.stats(), allocations.get_allocations(), allocations.get_deallocations()};
+  }
+
   // Операторы сравнения
   friend bool operator==(const bimap& lhs, const bimap& rhs) {
     if (lhs.size() != rhs.size()) {
@@ -414,10 +787,197 @@ public:
   }
 
 private:
+  template <typename Iter>
+  bool erase_found(Iter it) {
+    if (it.cur_node.is_end()) {
+      return false;
+    }
+    if constexpr (std::is_same_v<Iter, left_iterator>) {
+      erase_left(it);
+    } else {
+      erase_right(it);
+    }
+    return true;
+  }
+
+  template <typename Iter>
+  static const auto& at_impl(Iter it) {
+    if (it.cur_node.is_end()) {
+      throw std::out_of_range("key not found");
+    }
+    return *it.flip();
+  }
+
+  using left_tree_t = typename left_node::tree_type;
+  using right_tree_t = typename right_node::tree_type;
+
+  template <typename L, typename R>
+  data_node* create_node(L&& left, R&& right) {
+    data_node* node = node_alloc_traits::allocate(alloc, 1);
+    try {
+      node_alloc_traits::construct(alloc, node, std::forward<L>(left), std::forward<R>(right));
+    } catch (...) {
+      node_alloc_traits::deallocate(alloc, node, 1);
+      throw;
+    }
+    allocations.allocated();
+    return node;
+  }
+
+  void destroy_node(data_node* node) noexcept {
+    node_alloc_traits::destroy(alloc, node);
+    node_alloc_traits::deallocate(alloc, node, 1);
+    allocations.deallocated();
+  }
+
+  void destroy_nodes(const std::vector<data_node*>& nodes) noexcept {
+    for (data_node* node : nodes) {
+      destroy_node(node);
+    }
+  }
+
+  // Заполняет пустую bimap узлами, упорядоченными по left.
+  // При ошибке уничтожает все узлы.
+  void build_from_nodes(const std::vector<data_node*>& nodes) {
+    std::vector<right_node*> by_right;
+    try {
+      const auto& comp_left = left_tree.get_comp();
+      for (std::size_t i = 1; i < nodes.size(); i++) {
+        if (!comp_left(static_cast<left_node*>(nodes[i - 1])->dec, static_cast<left_node*>(nodes[i])->dec)) {
+          throw std::invalid_argument("left keys are not strictly increasing");
+        }
+      }
+      by_right.assign(nodes.begin(), nodes.end());
+      const auto& comp_right = right_tree.get_comp();
+      std::sort(by_right.begin(), by_right.end(),
+                [&comp_right](const right_node* lhs, const right_node* rhs) { return comp_right(lhs->dec, rhs->dec); });
+      for (std::size_t i = 1; i < by_right.size(); i++) {
+        if (!comp_right(by_right[i - 1]->dec, by_right[i]->dec)) {
+          throw std::invalid_argument("duplicate right key");
+        }
+      }
+    } catch (...) {
+      destroy_nodes(nodes);
+      throw;
+    }
+    try {
+      left_tree.build_sorted(nodes.begin(), nodes.end());
+      right_tree.build_sorted(by_right.begin(), by_right.end());
+    } catch (...) {
+      left_tree.clear([](left_node*) noexcept {});
+      right_tree.clear([](right_node*) noexcept {});
+      destroy_nodes(nodes);
+      throw;
+    }
+    elements_num = nodes.size();
+  }
+
+  template <typename L, typename R>
+  left_iterator insert_at(typename left_tree_t::insert_position left_pos,
+                          typename right_tree_t::insert_position right_pos, L&& left, R&& right) {
+    data_node* node = create_node(std::forward<L>(left), std::forward<R>(right));
+    try {
+      return attach(left_pos, right_pos, node);
+    } catch (...) {
+      destroy_node(node);
+      throw;
+    }
+  }
+
+  template <typename Tree, typename OtherTree, typename Iter>
+  std::size_t erase_range(Tree& tree, OtherTree& other_tree, Iter first, Iter last) noexcept {
+    using other_node = std::conditional_t<std::is_same_v<Iter, left_iterator>, right_node, left_node>;
+    std::size_t res = tree.erase(first.cur_node, last.cur_node, [&](auto* node) noexcept {
+      auto* data = static_cast<data_node*>(node);
+      other_tree.erase(static_cast<other_node*>(data));
+      destroy_node(data);
+    });
+    elements_num -= res;
+    return res;
+  }
+
+  // Место для key ищется одним спуском до вынимания узла. После вынимания
+  // само место может сдвинуться (повороты, слияние листов), но элемент,
+  // перед которым встает key, остается прежним, и по нему как по подсказке
+  // место находится за O(1) сравнений.
+  template <typename Tree, typename Iter, typename Key>
+  bool replace_key(Tree& tree, Iter it, Key&& key) {
+    auto pos = tree.find_position(key);
+    if (pos.occupied()) {
+      return pos.get() == it.cur_node;
+    }
+    auto hint = tree.successor(pos);
+    if (hint == it.cur_node) {
+      ++hint;
+    }
+    auto* node = tree.erase(it.cur_node);
+    try {
+      using key_type = std::remove_cvref_t<Key>;
+      if constexpr (std::is_nothrow_move_constructible_v<key_type>) {
+        std::destroy_at(&node->dec);
+        std::construct_at(&node->dec, std::move(key));
+      } else {
+        node->dec = std::move(key);
+      }
+      tree.insert(tree.find_position(hint, node->dec), node);
+    } catch (...) {
+      // Ключ в неизвестном состоянии: пробуем вернуть узел на место, а если
+      // это невозможно -- удаляем пару целиком.
+      bool restored = false;
+      try {
+        restored = tree.insert(node) != tree.end();
+      } catch (...) {}
+      if (!restored) {
+        auto* data = static_cast<data_node*>(node);
+        if constexpr (std::is_same_v<Iter, left_iterator>) {
+          right_tree.erase(static_cast<right_node*>(data));
+        } else {
+          left_tree.erase(static_cast<left_node*>(data));
+        }
+        destroy_node(data);
+        elements_num--;
+      }
+      throw;
+    }
+    return true;
+  }
+
+  template <typename Tree, typename K, typename Iter>
+  static void find_batch(const Tree& tree, std::span<const K> keys, std::span<Iter> out) {
+    if (keys.size() != out.size()) {
+      throw std::invalid_argument("find_batch: keys and out sizes differ");
+    }
+    tree.find_batch(keys.data(), keys.size(), [&out](std::size_t i, typename Tree::iterator it) { out[i] = Iter(it); });
+  }
+
+  // Подвешивает уже созданный узел в оба дерева. Если вставка бросает
+  // исключение (у btree -- при выделении вершины), узел не остается ни в
+  // одном дереве.
+  left_iterator attach(typename left_tree_t::insert_position left_pos, typename right_tree_t::insert_position right_pos,
+                       data_node* node) {
+    auto res = left_tree.insert(left_pos, static_cast<left_node*>(node));
+    try {
+      right_tree.insert(right_pos, static_cast<right_node*>(node));
+    } catch (...) {
+      left_tree.erase(res);
+      throw;
+    }
+    elements_num++;
+    return left_iterator(res);
+  }
+
+  // Вынимает узел из обоих деревьев, не уничтожая его.
+  data_node* detach(left_iterator it) noexcept {
+    right_tree.erase(it.flip().cur_node);
+    auto* node = static_cast<data_node*>(left_tree.erase(it.cur_node));
+    elements_num--;
+    return node;
+  }
+
   size_t elements_num{0};
+  [[no_unique_address]] node_allocator alloc;
+  [[no_unique_address]] intrusive::allocation_counters<> allocations;
   linking_node sentinel;
-  intrusive::tree<left_t, left_node, getter<left_t, left_node>, left, CompareLeft> left_tree{
-      static_cast<intrusive::tree_element<left>*>(&sentinel)};
-  intrusive::tree<right_t, right_node, getter<right_t, right_node>, right, CompareRight> right_tree{
-      static_cast<intrusive::tree_element<right>*>(&sentinel)};
+  left_tree_t left_tree;
+  right_tree_t right_tree;
 };
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// bimap для многих читателей и редких изменений. Читатели работают с
+// неизменяемой версией bimap и никогда не ждут: чтение -- это запись эпохи
+// в собственную ячейку, загрузка указателя на текущую версию и сброс ячейки.
+// Писатель копирует текущую версию, применяет к копии все изменения пакета,
+// публикует ее одной атомарной записью и освобождает старые версии, когда ни
+// один читатель больше не может их видеть (epoch-based reclamation).
+// Писатели сериализуются мьютексом; изменение стоит O(n) на копирование.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>, typename Allocator = std::allocator<std::pair<Left, Right>>>
+class concurrent_bimap {
+public:
+  using map_type = bimap<Left, Right, CompareLeft, CompareRight, Allocator>;
+  using left_t = Left;
+  using right_t = Right;
+
+private:
+  static constexpr std::uint64_t idle = 0;
+
+  // Ячейка одного читателя: эпоха, в которой он начал чтение, или idle.
+  // Каждая ячейка занимает свою кеш-линию, чтобы читатели не мешали друг другу.
+  struct alignas(64) reader_slot {
+    std::atomic<std::uint64_t> epoch{idle};
+    std::atomic<bool> taken{false};
+  };
+
+  struct retired_version {
+    std::unique_ptr<const map_type> version;
+    std::uint64_t epoch{0};
+  };
+
+public:
+  // Доступ на чтение для одного потока. Получается через make_reader и
+  // занимает ячейку, пока не будет уничтожен; должен быть уничтожен раньше
+  // concurrent_bimap. Одновременно пользоваться одним reader из нескольких
+  // потоков нельзя.
+  class reader {
+    friend concurrent_bimap;
+
+  public:
+    reader(reader&& other) noexcept : owner(other.owner), slot(other.slot) {
+      other.slot = nullptr;
+    }
+
+    reader& operator=(reader&& other) noexcept {
+      if (this != &other) {
+        release();
+        owner = other.owner;
+        slot = other.slot;
+        other.slot = nullptr;
+      }
+      return *this;
+    }
+
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    ~reader() {
+      release();
+    }
+
+    // Вызывает f(const map_type&) на текущей версии и возвращает результат.
+    // Ссылки и итераторы на версию нельзя сохранять после выхода из f.
+    template <typename F>
+    decltype(auto) read(F&& f) const {
+      slot->epoch.store(owner->global_epoch.load());
+      struct leave_guard {
+        reader_slot* slot;
+
+        ~leave_guard() {
+          slot->epoch.store(idle, std::memory_order_release);
+        }
+      } guard{slot};
+      return std::forward<F>(f)(*owner->current.load());
+    }
+
+    bool contains_left(const left_t& key) const {
+      return read([&key](const map_type& map) { return map.find_left(key) != map.end_left(); });
+    }
+
+    bool contains_right(const right_t& key) const {
+      return read([&key](const map_type& map) { return map.find_right(key) != map.end_right(); });
+    }
+
+    // Как bimap::at_left, но возвращает копию: версия может быть освобождена
+    // сразу после чтения.
+    right_t at_left(const left_t& key) const {
+      return read([&key](const map_type& map) { return right_t(map.at_left(key)); });
+    }
+
+    left_t at_right(const right_t& key) const {
+      return read([&key](const map_type& map) { return left_t(map.at_right(key)); });
+    }
+
+  private:
+    reader(const concurrent_bimap* owner, reader_slot* slot) : owner(owner), slot(slot) {}
+
+    void release() noexcept {
+      if (slot != nullptr) {
+        slot->taken.store(false, std::memory_order_release);
+        slot = nullptr;
+      }
+    }
+
+    const concurrent_bimap* owner;
+    reader_slot* slot;
+  };
+
+  // max_readers -- сколько reader может существовать одновременно.
+  explicit concurrent_bimap(map_type initial = map_type(), std::size_t max_readers = 64)
+      : slots(max_readers),
+        current(new map_type(std::move(initial))) {}
+
+  concurrent_bimap(const concurrent_bimap&) = delete;
+  concurrent_bimap& operator=(const concurrent_bimap&) = delete;
+
+  ~concurrent_bimap() {
+    delete current.load();
+  }
+
+  // Занимает свободную ячейку читателя. Если все max_readers ячеек заняты,
+  // бросает std::length_error.
+  reader make_reader() const {
+    for (reader_slot& slot : slots) {
+      bool expected = false;
+      if (!slot.taken.load(std::memory_order_relaxed) && slot.taken.compare_exchange_strong(expected, true)) {
+        return reader(this, &slot);
+      }
+    }
+    throw std::length_error("too many concurrent_bimap readers");
+  }
+
+  // Применяет mutator(map_type&) к копии текущей версии и публикует ее.
+  // Читатели видят либо все изменения пакета, либо ни одного. Если mutator
+  // бросает исключение, текущая версия не меняется.
+  template <typename F>
+  void update(F&& mutator) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    auto next = std::make_unique<map_type>(*current.load());
+    std::forward<F>(mutator)(*next);
+    retired.emplace_back();
+    const map_type* old = current.exchange(next.release());
+    // Читатель, увидевший новую эпоху, гарантированно увидит и новую версию,
+    // поэтому old нужна только читателям, начавшим чтение до этой эпохи.
+    retired.back().epoch = global_epoch.fetch_add(1) + 1;
+    retired.back().version.reset(old);
+    reclaim();
+  }
+
+  // Освобождает версии, которые больше не может видеть ни один читатель.
+  // Вызывается из update; отдельно нужна, если изменений давно не было.
+  void collect() {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    reclaim();
+  }
+
+private:
+  void reclaim() {
+    std::uint64_t oldest = global_epoch.load();
+    for (const reader_slot& slot : slots) {
+      std::uint64_t epoch = slot.epoch.load();
+      if (epoch != idle && epoch < oldest) {
+        oldest = epoch;
+      }
+    }
+    std::erase_if(retired, [oldest](const retired_version& cur) { return cur.epoch <= oldest; });
+  }
+
+  mutable std::vector<reader_slot> slots;
+  alignas(64) std::atomic<std::uint64_t> global_epoch{1};
+  std::atomic<const map_type*> current;
+  alignas(64) std::mutex writer_mutex;
+  std::vector<retired_version> retired;
+};
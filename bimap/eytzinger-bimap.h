@@ -0,0 +1,370 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Неизменяемый снимок двустороннего словаря для поиска. Ключи каждой стороны
+// лежат в массиве в порядке Эйтцингера: неявное двоичное дерево поиска,
+// записанное по уровням (сыновья вершины k -- 2k и 2k + 1). Спуск по нему --
+// цикл без ветвлений, а вершины нескольких следующих уровней лежат рядом,
+// поэтому их можно запросить заранее, и промах на каждом уровне не ждет
+// предыдущего. Массивы перекрестных индексов связывают ключ с парным ключом
+// на другой стороне. Снимок строится из bimap за O(n) и не меняется.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>, typename Allocator = std::allocator<std::pair<Left, Right>>>
+class eytzinger_bimap {
+public:
+  using left_t = Left;
+  using right_t = Right;
+  using index_t = std::uint32_t;
+
+private:
+  struct left;
+  struct right;
+  template <typename>
+  class universal_iterator;
+
+  template <typename T>
+  using array = std::vector<T, typename std::allocator_traits<Allocator>::template rebind_alloc<T>>;
+
+  template <typename Tag>
+  struct side_traits {
+    static constexpr bool is_left = std::is_same_v<Tag, left>;
+
+    using key_type = std::conditional_t<is_left, Left, Right>;
+    using friend_tag = std::conditional_t<is_left, right, left>;
+  };
+
+  // Позиции хранятся с единицы, 0 -- end. keys[k - 1] -- ключ вершины k.
+  // Следующая вершина в порядке возрастания ключей: самая левая в правом
+  // поддереве, а если его нет -- ближайший предок, для которого k в левом
+  // поддереве.
+  static std::size_t next_pos(std::size_t k, std::size_t n) noexcept {
+    if (2 * k + 1 <= n) {
+      k = 2 * k + 1;
+      while (2 * k <= n) {
+        k = 2 * k;
+      }
+      return k;
+    }
+    return k >> (std::countr_one(k) + 1);
+  }
+
+  static std::size_t prev_pos(std::size_t k, std::size_t n) noexcept {
+    if (k == 0 || 2 * k <= n) {
+      k = k == 0 ? 1 : 2 * k;
+      while (2 * k + 1 <= n) {
+        k = 2 * k + 1;
+      }
+      return k;
+    }
+    return k >> (std::countr_zero(k) + 1);
+  }
+
+  template <typename Tag>
+  class universal_iterator {
+  private:
+    template <typename, typename, typename, typename, typename>
+    friend class eytzinger_bimap;
+    template <typename>
+    friend class universal_iterator;
+
+    using traits = side_traits<Tag>;
+
+  public:
+    using value_type = typename traits::key_type;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    universal_iterator() = default;
+
+    const value_type& operator*() const {
+      return owner->template keys<Tag>()[pos - 1];
+    }
+
+    const value_type* operator->() const {
+      return &**this;
+    }
+
+    universal_iterator& operator++() {
+      pos = next_pos(pos, owner->size());
+      return *this;
+    }
+
+    universal_iterator operator++(int) {
+      universal_iterator temp = *this;
+      ++(*this);
+      return temp;
+    }
+
+    universal_iterator& operator--() {
+      pos = prev_pos(pos, owner->size());
+      return *this;
+    }
+
+    universal_iterator operator--(int) {
+      universal_iterator temp = *this;
+      --(*this);
+      return temp;
+    }
+
+    universal_iterator<typename traits::friend_tag> flip() const {
+      if (pos == 0) {
+        return {owner, 0};
+      }
+      return {owner, owner->template partners<Tag>()[pos - 1]};
+    }
+
+    friend bool operator==(const universal_iterator& lhs, const universal_iterator& rhs) {
+      return lhs.pos == rhs.pos && lhs.owner == rhs.owner;
+    }
+
+    friend bool operator!=(const universal_iterator& lhs, const universal_iterator& rhs) {
+      return !(lhs == rhs);
+    }
+
+  private:
+    universal_iterator(const eytzinger_bimap* owner, std::size_t pos) : owner(owner), pos(pos) {}
+
+    const eytzinger_bimap* owner{nullptr};
+    std::size_t pos{0};
+  };
+
+public:
+  using allocator_type = Allocator;
+  using left_iterator = universal_iterator<left>;
+  using right_iterator = universal_iterator<right>;
+
+  // Строит снимок map (bimap или flat_bimap с теми же типами ключей) за O(n):
+  // один обход каждой стороны по порядку и хеш-таблица из адресов левых
+  // ключей в позиции. compare_left и compare_right должны упорядочивать ключи так же,
+  // как компараторы map.
+  template <typename Map>
+  explicit eytzinger_bimap(const Map& map, CompareLeft compare_left = CompareLeft(),
+                           CompareRight compare_right = CompareRight(), const Allocator& allocator = Allocator())
+      : comp_left(std::move(compare_left)),
+        comp_right(std::move(compare_right)),
+        left_keys(allocator),
+        right_keys(allocator),
+        left_partner(allocator),
+        right_partner(allocator) {
+    static_assert(std::is_same_v<typename Map::left_t, Left> && std::is_same_v<typename Map::right_t, Right>,
+                  "key types of map must match eytzinger_bimap");
+    std::size_t n = map.size();
+    if (n > std::numeric_limits<index_t>::max()) {
+      throw std::length_error("eytzinger_bimap is too large");
+    }
+    if (n == 0) {
+      return;
+    }
+    left_partner.resize(n);
+    right_partner.resize(n);
+    // Каждая сторона обходится один раз: ключи копируются по порядку, а k
+    // пробегает позиции Эйтцингера в том же порядке.
+    std::vector<Left> left_sorted;
+    left_sorted.reserve(n);
+    std::unordered_map<const Left*, index_t> pos_of_left;
+    pos_of_left.reserve(n);
+    std::size_t k = first_pos(n);
+    for (auto it = map.begin_left(); it != map.end_left(); ++it, k = next_pos(k, n)) {
+      left_sorted.push_back(*it);
+      pos_of_left.emplace(&*it, static_cast<index_t>(k));
+    }
+    std::vector<Right> right_sorted;
+    right_sorted.reserve(n);
+    k = first_pos(n);
+    for (auto it = map.begin_right(); it != map.end_right(); ++it, k = next_pos(k, n)) {
+      right_sorted.push_back(*it);
+      index_t partner = pos_of_left.at(&*it.flip());
+      right_partner[k - 1] = partner;
+      left_partner[partner - 1] = static_cast<index_t>(k);
+    }
+    std::vector<index_t> rank_of_slot = eytzinger_ranks(n);
+    place(left_sorted, rank_of_slot, left_keys);
+    place(right_sorted, rank_of_slot, right_keys);
+  }
+
+  // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  left_iterator find_left(const left_t& left) const {
+    std::size_t pos = lower_bound(left_keys, left, comp_left);
+    return {this, (pos != 0 && !comp_left(left, left_keys[pos - 1])) ? pos : 0};
+  }
+
+  right_iterator find_right(const right_t& right) const {
+    std::size_t pos = lower_bound(right_keys, right, comp_right);
+    return {this, (pos != 0 && !comp_right(right, right_keys[pos - 1])) ? pos : 0};
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  const right_t& at_left(const left_t& key) const {
+    auto it = find_left(key);
+    if (it.pos == 0) {
+      throw std::out_of_range("key not found");
+    }
+    return *it.flip();
+  }
+
+  const left_t& at_right(const right_t& key) const {
+    auto it = find_right(key);
+    if (it.pos == 0) {
+      throw std::out_of_range("key not found");
+    }
+    return *it.flip();
+  }
+
+  // lower и upper bound'ы по каждой стороне
+  left_iterator lower_bound_left(const left_t& left) const {
+    return {this, lower_bound(left_keys, left, comp_left)};
+  }
+
+  left_iterator upper_bound_left(const left_t& left) const {
+    return {this, upper_bound(left_keys, left, comp_left)};
+  }
+
+  right_iterator lower_bound_right(const right_t& right) const {
+    return {this, lower_bound(right_keys, right, comp_right)};
+  }
+
+  right_iterator upper_bound_right(const right_t& right) const {
+    return {this, upper_bound(right_keys, right, comp_right)};
+  }
+
+  left_iterator begin_left() const {
+    return {this, empty() ? 0 : first_pos(size())};
+  }
+
+  left_iterator end_left() const {
+    return {this, 0};
+  }
+
+  right_iterator begin_right() const {
+    return {this, empty() ? 0 : first_pos(size())};
+  }
+
+  right_iterator end_right() const {
+    return {this, 0};
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(left_keys.get_allocator());
+  }
+
+  bool empty() const {
+    return left_keys.empty();
+  }
+
+  std::size_t size() const {
+    return left_keys.size();
+  }
+
+  friend void swap(eytzinger_bimap& lhs, eytzinger_bimap& rhs) noexcept {
+    using std::swap;
+    swap(lhs.comp_left, rhs.comp_left);
+    swap(lhs.comp_right, rhs.comp_right);
+    lhs.left_keys.swap(rhs.left_keys);
+    lhs.right_keys.swap(rhs.right_keys);
+    lhs.left_partner.swap(rhs.left_partner);
+    lhs.right_partner.swap(rhs.right_partner);
+  }
+
+private:
+  template <typename Tag>
+  const auto& keys() const noexcept {
+    if constexpr (std::is_same_v<Tag, left>) {
+      return left_keys;
+    } else {
+      return right_keys;
+    }
+  }
+
+  template <typename Tag>
+  const array<index_t>& partners() const noexcept {
+    if constexpr (std::is_same_v<Tag, left>) {
+      return left_partner;
+    } else {
+      return right_partner;
+    }
+  }
+
+  // Позиция минимального ключа: самая левая вершина.
+  static std::size_t first_pos(std::size_t n) noexcept {
+    return std::bit_floor(n);
+  }
+
+  // rank_of_slot[k - 1] -- номер по возрастанию ключа в позиции k.
+  static std::vector<index_t> eytzinger_ranks(std::size_t n) {
+    std::vector<index_t> rank_of_slot(n);
+    std::size_t k = first_pos(n);
+    for (std::size_t rank = 0; rank < n; rank++, k = next_pos(k, n)) {
+      rank_of_slot[k - 1] = static_cast<index_t>(rank);
+    }
+    return rank_of_slot;
+  }
+
+  // Перекладывает ключи sorted, идущие по возрастанию, в keys по позициям
+  // Эйтцингера.
+  template <typename Key, typename Keys>
+  static void place(std::vector<Key>& sorted, const std::vector<index_t>& rank_of_slot, Keys& keys) {
+    keys.reserve(sorted.size());
+    for (index_t rank : rank_of_slot) {
+      keys.push_back(std::move(sorted[rank]));
+    }
+  }
+
+  // Сколько ключей помещается в кеш-линию: столько потомков вершины k на
+  // log2 этого числа уровней ниже лежат подряд, начиная с позиции k * lookahead.
+  template <typename Key>
+  static constexpr std::size_t lookahead = std::bit_floor(std::max<std::size_t>(1, 64 / sizeof(Key)));
+
+  // Спуск без ветвлений: k уходит в сына 2k или 2k + 1 по результату
+  // сравнения, а после выхода за n снимаются последние повороты направо --
+  // остается позиция первого ключа, не меньшего key, или 0.
+  template <typename Keys, typename K, typename Compare>
+  static std::size_t lower_bound(const Keys& keys, const K& key, const Compare& comp) {
+    using key_type = typename Keys::value_type;
+    std::size_t n = keys.size();
+    std::size_t k = 1;
+    while (k <= n) {
+      intrusive::prefetch(keys.data() + std::min(k * lookahead<key_type>, n) - 1);
+      k = 2 * k + comp(keys[k - 1], key);
+    }
+    return k >> (std::countr_one(k) + 1);
+  }
+
+  template <typename Keys, typename K, typename Compare>
+  static std::size_t upper_bound(const Keys& keys, const K& key, const Compare& comp) {
+    using key_type = typename Keys::value_type;
+    std::size_t n = keys.size();
+    std::size_t k = 1;
+    while (k <= n) {
+      intrusive::prefetch(keys.data() + std::min(k * lookahead<key_type>, n) - 1);
+      k = 2 * k + !comp(key, keys[k - 1]);
+    }
+    return k >> (std::countr_one(k) + 1);
+  }
+
+  [[no_unique_address]] CompareLeft comp_left;
+  [[no_unique_address]] CompareRight comp_right;
+  array<Left> left_keys;
+  array<Right> right_keys;
+  // left_partner[k - 1] -- позиция на правой стороне пары ключа в позиции k
+  // левой стороны, и наоборот.
+  array<index_t> left_partner;
+  array<index_t> right_partner;
+};
@@ -0,0 +1,548 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Двусторонний словарь, оптимизированный на чтение. Ключи каждой стороны
+// лежат в своем непрерывном отсортированном массиве, а два массива
+// перекрестных индексов связывают позицию ключа на одной стороне с позицией
+// парного ключа на другой. Поиск -- двоичный поиск по массиву ключей без
+// ветвлений в цикле, flip -- одно обращение к массиву индексов.
+// Изменения копятся в batch и применяются одним слиянием за O(n + k log k).
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>, typename Allocator = std::allocator<std::pair<Left, Right>>>
+class flat_bimap {
+public:
+  using left_t = Left;
+  using right_t = Right;
+  using index_t = std::uint32_t;
+
+private:
+  struct left;
+  struct right;
+  template <typename>
+  class universal_iterator;
+
+  template <typename T>
+  using array = std::vector<T, typename std::allocator_traits<Allocator>::template rebind_alloc<T>>;
+
+  template <typename Tag>
+  struct side_traits {
+    static constexpr bool is_left = std::is_same_v<Tag, left>;
+
+    using key_type = std::conditional_t<is_left, Left, Right>;
+    using friend_tag = std::conditional_t<is_left, right, left>;
+  };
+
+  template <typename Tag>
+  class universal_iterator {
+  private:
+    template <typename, typename, typename, typename, typename>
+    friend class flat_bimap;
+    template <typename>
+    friend class universal_iterator;
+
+    using traits = side_traits<Tag>;
+
+  public:
+    using value_type = typename traits::key_type;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    universal_iterator() = default;
+
+    const value_type& operator*() const {
+      return owner->template keys<Tag>()[pos];
+    }
+
+    const value_type* operator->() const {
+      return &**this;
+    }
+
+    universal_iterator& operator++() {
+      ++pos;
+      return *this;
+    }
+
+    universal_iterator operator++(int) {
+      universal_iterator temp = *this;
+      ++(*this);
+      return temp;
+    }
+
+    universal_iterator& operator--() {
+      --pos;
+      return *this;
+    }
+
+    universal_iterator operator--(int) {
+      universal_iterator temp = *this;
+      --(*this);
+      return temp;
+    }
+
+    universal_iterator<typename traits::friend_tag> flip() const {
+      if (pos == owner->size()) {
+        return {owner, pos};
+      }
+      return {owner, owner->template partners<Tag>()[pos]};
+    }
+
+    friend bool operator==(const universal_iterator& lhs, const universal_iterator& rhs) {
+      return lhs.pos == rhs.pos && lhs.owner == rhs.owner;
+    }
+
+    friend bool operator!=(const universal_iterator& lhs, const universal_iterator& rhs) {
+      return !(lhs == rhs);
+    }
+
+  private:
+    universal_iterator(const flat_bimap* owner, std::size_t pos) : owner(owner), pos(pos) {}
+
+    const flat_bimap* owner{nullptr};
+    std::size_t pos{0};
+  };
+
+public:
+  using allocator_type = Allocator;
+  using left_iterator = universal_iterator<left>;
+  using right_iterator = universal_iterator<right>;
+
+  // Набор изменений для apply. Сначала применяются все удаления, затем
+  // вставки в порядке добавления с той же семантикой, что у bimap::insert:
+  // пара, left или right которой уже присутствует, пропускается.
+  class batch {
+    friend flat_bimap;
+
+  public:
+    template <typename L = Left, typename R = Right>
+    void insert(L&& left, R&& right) {
+      inserts.emplace_back(std::forward<L>(left), std::forward<R>(right));
+    }
+
+    template <typename L = Left>
+    void erase_left(L&& left) {
+      left_erases.emplace_back(std::forward<L>(left));
+    }
+
+    template <typename R = Right>
+    void erase_right(R&& right) {
+      right_erases.emplace_back(std::forward<R>(right));
+    }
+
+    bool empty() const noexcept {
+      return inserts.empty() && left_erases.empty() && right_erases.empty();
+    }
+
+  private:
+    std::vector<std::pair<Left, Right>> inserts;
+    std::vector<Left> left_erases;
+    std::vector<Right> right_erases;
+  };
+
+  // Создает flat_bimap, не содержащий ни одной пары.
+  flat_bimap(CompareLeft compare_left = CompareLeft(), CompareRight compare_right = CompareRight(),
+             const Allocator& allocator = Allocator())
+      : comp_left(std::move(compare_left)),
+        comp_right(std::move(compare_right)),
+        left_keys(allocator),
+        right_keys(allocator),
+        left_partner(allocator),
+        right_partner(allocator) {}
+
+  // Строит flat_bimap из произвольно упорядоченных пар (left, right) за
+  // O(n log n). Если среди left или среди right есть повторы, бросает
+  // std::invalid_argument.
+  template <typename InputIt>
+  flat_bimap(InputIt first, InputIt last, CompareLeft compare_left = CompareLeft(),
+             CompareRight compare_right = CompareRight(), const Allocator& allocator = Allocator())
+      : flat_bimap(std::move(compare_left), std::move(compare_right), allocator) {
+    std::vector<std::pair<Left, Right>> pairs(first, last);
+    check_capacity(pairs.size());
+    std::vector<index_t> order(pairs.size());
+    for (std::size_t i = 0; i < order.size(); i++) {
+      order[i] = static_cast<index_t>(i);
+    }
+    std::sort(order.begin(), order.end(),
+              [this, &pairs](index_t lhs, index_t rhs) { return comp_left(pairs[lhs].first, pairs[rhs].first); });
+    left_keys.reserve(pairs.size());
+    right_keys.reserve(pairs.size());
+    for (index_t i : order) {
+      left_keys.push_back(std::move(pairs[i].first));
+    }
+    // order[p] -- исходный номер пары, стоящей на позиции p по left.
+    // Сортируем позиции по right, чтобы получить порядок правой стороны.
+    std::vector<index_t> by_right(pairs.size());
+    for (std::size_t i = 0; i < by_right.size(); i++) {
+      by_right[i] = static_cast<index_t>(i);
+    }
+    std::sort(by_right.begin(), by_right.end(), [this, &pairs, &order](index_t lhs, index_t rhs) {
+      return comp_right(pairs[order[lhs]].second, pairs[order[rhs]].second);
+    });
+    for (index_t pos : by_right) {
+      right_keys.push_back(std::move(pairs[order[pos]].second));
+    }
+    link_partners(by_right);
+    check_unique();
+  }
+
+  // Применяет изменения из changes одним слиянием. Если будет брошено
+  // исключение, flat_bimap не изменится.
+  void apply(batch changes) {
+    merge(std::move(changes));
+  }
+
+  // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  left_iterator find_left(const left_t& left) const {
+    std::size_t pos = lower_bound(left_keys, left, comp_left);
+    return {this, (pos != size() && !comp_left(left, left_keys[pos])) ? pos : size()};
+  }
+
+  right_iterator find_right(const right_t& right) const {
+    std::size_t pos = lower_bound(right_keys, right, comp_right);
+    return {this, (pos != size() && !comp_right(right, right_keys[pos])) ? pos : size()};
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  const right_t& at_left(const left_t& key) const {
+    auto it = find_left(key);
+    if (it.pos == size()) {
+      throw std::out_of_range("key not found");
+    }
+    return *it.flip();
+  }
+
+  const left_t& at_right(const right_t& key) const {
+    auto it = find_right(key);
+    if (it.pos == size()) {
+      throw std::out_of_range("key not found");
+    }
+    return *it.flip();
+  }
+
+  // lower и upper bound'ы по каждой стороне
+  left_iterator lower_bound_left(const left_t& left) const {
+    return {this, lower_bound(left_keys, left, comp_left)};
+  }
+
+  left_iterator upper_bound_left(const left_t& left) const {
+    return {this, upper_bound(left_keys, left, comp_left)};
+  }
+
+  right_iterator lower_bound_right(const right_t& right) const {
+    return {this, lower_bound(right_keys, right, comp_right)};
+  }
+
+  right_iterator upper_bound_right(const right_t& right) const {
+    return {this, upper_bound(right_keys, right, comp_right)};
+  }
+
+  left_iterator begin_left() const {
+    return {this, 0};
+  }
+
+  left_iterator end_left() const {
+    return {this, size()};
+  }
+
+  right_iterator begin_right() const {
+    return {this, 0};
+  }
+
+  right_iterator end_right() const {
+    return {this, size()};
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(left_keys.get_allocator());
+  }
+
+  bool empty() const {
+    return left_keys.empty();
+  }
+
+  std::size_t size() const {
+    return left_keys.size();
+  }
+
+  friend void swap(flat_bimap& lhs, flat_bimap& rhs) noexcept {
+    using std::swap;
+    swap(lhs.comp_left, rhs.comp_left);
+    swap(lhs.comp_right, rhs.comp_right);
+    lhs.left_keys.swap(rhs.left_keys);
+    lhs.right_keys.swap(rhs.right_keys);
+    lhs.left_partner.swap(rhs.left_partner);
+    lhs.right_partner.swap(rhs.right_partner);
+  }
+
+  friend bool operator==(const flat_bimap& lhs, const flat_bimap& rhs) {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+    for (std::size_t i = 0; i < lhs.size(); i++) {
+      const Right& lhs_right = lhs.right_keys[lhs.left_partner[i]];
+      const Right& rhs_right = rhs.right_keys[rhs.left_partner[i]];
+      if (lhs.comp_left(lhs.left_keys[i], rhs.left_keys[i]) || lhs.comp_left(rhs.left_keys[i], lhs.left_keys[i]) ||
+          lhs.comp_right(lhs_right, rhs_right) || lhs.comp_right(rhs_right, lhs_right)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend bool operator!=(const flat_bimap& lhs, const flat_bimap& rhs) {
+    return !(lhs == rhs);
+  }
+
+private:
+  // Все, что может бросить, -- поиск, сравнения и выделение памяти -- делается
+  // до того, как из *this переносится первый ключ. Затем ключи переносятся в
+  // заранее выделенные массивы, и бросить там может только копирование ключа,
+  // перемещение которого не noexcept; копирование *this не меняет.
+  void merge(batch changes) {
+    std::vector<bool> keep(size(), true);
+    for (const Left& key : changes.left_erases) {
+      std::size_t pos = find_left(key).pos;
+      if (pos != size()) {
+        keep[pos] = false;
+      }
+    }
+    for (const Right& key : changes.right_erases) {
+      std::size_t pos = find_right(key).pos;
+      if (pos != size()) {
+        keep[right_partner[pos]] = false;
+      }
+    }
+
+    // Вставки, не задевающие оставшиеся пары. Из вставок с равным left или
+    // равным right, как в bimap::insert, остается первая по порядку.
+    std::vector<std::pair<Left, Right>>& inserts = changes.inserts;
+    std::vector<std::size_t> added_left;
+    for (std::size_t i = 0; i < inserts.size(); i++) {
+      left_iterator l_it = find_left(inserts[i].first);
+      right_iterator r_it = find_right(inserts[i].second);
+      if ((l_it.pos == size() || !keep[l_it.pos]) && (r_it.pos == size() || !keep[right_partner[r_it.pos]])) {
+        added_left.push_back(i);
+      }
+    }
+    std::vector<std::size_t> added_right(added_left);
+    auto left_less = [this, &inserts](std::size_t lhs, std::size_t rhs) {
+      return comp_left(inserts[lhs].first, inserts[rhs].first);
+    };
+    auto right_less = [this, &inserts](std::size_t lhs, std::size_t rhs) {
+      return comp_right(inserts[lhs].second, inserts[rhs].second);
+    };
+    std::sort(added_left.begin(), added_left.end(), left_less);
+    std::sort(added_right.begin(), added_right.end(), right_less);
+    std::vector<std::size_t> left_group = group_equal(added_left, inserts.size(), left_less);
+    std::vector<std::size_t> right_group = group_equal(added_right, inserts.size(), right_less);
+    // Сначала отмечены все подходящие вставки, затем в порядке добавления
+    // отметка снимается с тех, чей left или right уже занят.
+    std::vector<bool> accepted(inserts.size(), false);
+    std::vector<bool> left_taken(added_left.size(), false);
+    std::vector<bool> right_taken(added_right.size(), false);
+    for (std::size_t i : added_right) {
+      accepted[i] = true;
+    }
+    for (std::size_t i = 0; i < inserts.size(); i++) {
+      if (accepted[i]) {
+        accepted[i] = !left_taken[left_group[i]] && !right_taken[right_group[i]];
+        left_taken[left_group[i]] = left_taken[left_group[i]] || accepted[i];
+        right_taken[right_group[i]] = right_taken[right_group[i]] || accepted[i];
+      }
+    }
+    std::erase_if(added_left, [&accepted](std::size_t i) { return !accepted[i]; });
+    std::erase_if(added_right, [&accepted](std::size_t i) { return !accepted[i]; });
+
+    std::size_t new_size = added_left.size();
+    for (bool flag : keep) {
+      new_size += flag;
+    }
+    check_capacity(new_size);
+
+    // Порядок новой левой стороны: номер меньше size() -- старая позиция,
+    // остальные -- номер вставки, сдвинутый на size().
+    std::vector<index_t> old_to_new(size());
+    std::vector<index_t> added_to_new(inserts.size());
+    std::vector<std::size_t> left_source;
+    left_source.reserve(new_size);
+    std::size_t pos = 0;
+    std::size_t added = 0;
+    while (pos < size() || added < added_left.size()) {
+      if (pos < size() && !keep[pos]) {
+        pos++;
+      } else if (added == added_left.size() ||
+                 (pos < size() && comp_left(left_keys[pos], inserts[added_left[added]].first))) {
+        old_to_new[pos] = static_cast<index_t>(left_source.size());
+        left_source.push_back(pos++);
+      } else {
+        added_to_new[added_left[added]] = static_cast<index_t>(left_source.size());
+        left_source.push_back(size() + added_left[added++]);
+      }
+    }
+    // Правая сторона: для каждой новой позиции по right -- откуда взять ключ и
+    // позиция его пары по left.
+    std::vector<std::size_t> right_source;
+    std::vector<index_t> by_right;
+    right_source.reserve(new_size);
+    by_right.reserve(new_size);
+    pos = 0;
+    added = 0;
+    while (pos < size() || added < added_right.size()) {
+      if (pos < size() && !keep[right_partner[pos]]) {
+        pos++;
+      } else if (added == added_right.size() ||
+                 (pos < size() && comp_right(right_keys[pos], inserts[added_right[added]].second))) {
+        by_right.push_back(old_to_new[right_partner[pos]]);
+        right_source.push_back(pos++);
+      } else {
+        by_right.push_back(added_to_new[added_right[added]]);
+        right_source.push_back(size() + added_right[added++]);
+      }
+    }
+
+    flat_bimap res(comp_left, comp_right, get_allocator());
+    res.left_keys.reserve(new_size);
+    res.right_keys.reserve(new_size);
+    res.left_partner.reserve(new_size);
+    res.right_partner.reserve(new_size);
+    auto fill_left = [&] {
+      transfer(res.left_keys, left_keys, left_source, [&inserts](std::size_t i) -> Left& { return inserts[i].first; });
+    };
+    auto fill_right = [&] {
+      transfer(res.right_keys, right_keys, right_source,
+               [&inserts](std::size_t i) -> Right& { return inserts[i].second; });
+    };
+    // Сторона, ключи которой копируются, заполняется первой: пока копирование
+    // может бросить, ключи *this еще на месте.
+    if constexpr (std::is_nothrow_move_constructible_v<Left>) {
+      fill_right();
+      fill_left();
+    } else {
+      fill_left();
+      fill_right();
+    }
+    res.link_partners(by_right);
+    swap(*this, res);
+  }
+
+  // Номер группы равных ключей для каждой вставки из sorted, упорядоченного
+  // по less; остальные вставки из count получают ноль.
+  template <typename Less>
+  static std::vector<std::size_t> group_equal(const std::vector<std::size_t>& sorted, std::size_t count, Less less) {
+    std::vector<std::size_t> res(count, 0);
+    for (std::size_t i = 1; i < sorted.size(); i++) {
+      res[sorted[i]] = res[sorted[i - 1]] + less(sorted[i - 1], sorted[i]);
+    }
+    return res;
+  }
+
+  // Дописывает в to ключи в порядке source: номера меньше from.size() берутся
+  // из from, остальные -- из вставок через added. Память в to уже выделена.
+  template <typename Keys, typename Added>
+  static void transfer(Keys& to, Keys& from, const std::vector<std::size_t>& source, Added added) {
+    for (std::size_t src : source) {
+      if (src < from.size()) {
+        to.push_back(std::move_if_noexcept(from[src]));
+      } else {
+        to.push_back(std::move_if_noexcept(added(src - from.size())));
+      }
+    }
+  }
+
+  template <typename Tag>
+  const auto& keys() const noexcept {
+    if constexpr (std::is_same_v<Tag, left>) {
+      return left_keys;
+    } else {
+      return right_keys;
+    }
+  }
+
+  template <typename Tag>
+  const array<index_t>& partners() const noexcept {
+    if constexpr (std::is_same_v<Tag, left>) {
+      return left_partner;
+    } else {
+      return right_partner;
+    }
+  }
+
+  // Двоичный поиск, в котором выбор половины -- условное присваивание,
+  // а не переход, и число итераций зависит только от размера.
+  template <typename Keys, typename K, typename Compare>
+  static std::size_t lower_bound(const Keys& keys, const K& key, const Compare& comp) {
+    if (keys.empty()) {
+      return 0;
+    }
+    const auto* base = keys.data();
+    std::size_t len = keys.size();
+    while (len > 1) {
+      std::size_t half = len / 2;
+      base = comp(base[half - 1], key) ? base + half : base;
+      len -= half;
+    }
+    return (base - keys.data()) + comp(*base, key);
+  }
+
+  template <typename Keys, typename K, typename Compare>
+  static std::size_t upper_bound(const Keys& keys, const K& key, const Compare& comp) {
+    if (keys.empty()) {
+      return 0;
+    }
+    const auto* base = keys.data();
+    std::size_t len = keys.size();
+    while (len > 1) {
+      std::size_t half = len / 2;
+      base = !comp(key, base[half - 1]) ? base + half : base;
+      len -= half;
+    }
+    return (base - keys.data()) + !comp(key, *base);
+  }
+
+  static void check_capacity(std::size_t count) {
+    if (count > std::numeric_limits<index_t>::max()) {
+      throw std::length_error("flat_bimap is too large");
+    }
+  }
+
+  // by_right[p] -- позиция по left пары, стоящей на позиции p по right.
+  void link_partners(const std::vector<index_t>& by_right) {
+    right_partner.assign(by_right.begin(), by_right.end());
+    left_partner.resize(by_right.size());
+    for (std::size_t i = 0; i < by_right.size(); i++) {
+      left_partner[by_right[i]] = static_cast<index_t>(i);
+    }
+  }
+
+  void check_unique() const {
+    for (std::size_t i = 1; i < size(); i++) {
+      if (!comp_left(left_keys[i - 1], left_keys[i])) {
+        throw std::invalid_argument("duplicate left key");
+      }
+      if (!comp_right(right_keys[i - 1], right_keys[i])) {
+        throw std::invalid_argument("duplicate right key");
+      }
+    }
+  }
+
+  [[no_unique_address]] CompareLeft comp_left;
+  [[no_unique_address]] CompareRight comp_right;
+  array<Left> left_keys;
+  array<Right> right_keys;
+  // left_partner[i] -- позиция по right пары i-го по left ключа, и наоборот.
+  array<index_t> left_partner;
+  array<index_t> right_partner;
+};
@@ -0,0 +1,1132 @@
+#pragma once
+
+#include "intrusive-tree.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace intrusive {
+
+// Звено кольцевого списка листьев btree. Голова списка -- единственное
+// звено с count == 0.
+struct btree_link {
+  btree_link* prev = this;
+  btree_link* next = this;
+  std::uint32_t count = 0;
+};
+
+// Хук элемента btree: лист, в котором лежит элемент, и номер элемента в нем.
+// У головы дерева leaf указывает на голову списка листьев.
+template <typename Tag = default_tag>
+class btree_element {
+  template <typename, typename, typename, typename, typename, typename>
+  friend class btree;
+
+  btree_link* leaf = nullptr;
+  std::uint32_t slot = 0;
+};
+
+// B+-дерево над элементами, унаследованными от btree_element<Tag>, с тем же
+// интерфейсом, что у tree. Ключи копируются в вершины: внутренние хранят
+// разделители и размеры поддеревьев, листья -- ключи и указатели на
+// элементы, так что спуск читает несколько соседних кеш-линий на уровень
+// вместо одной зависимой загрузки на каждый из ~log2(n) уровней.
+// Итераторы указывают на элементы и, как у tree, не инвалидируются вставками
+// и удалениями других элементов; вставка может бросить исключение при
+// выделении вершины, и тогда дерево не меняется.
+// Data_type должен конструироваться по умолчанию, копироваться и
+// перемещаться без исключений.
+// Некорневой лист обычно заполнен хотя бы на leaf_min. Удаление, которое
+// перекладывает элемент от соседа, копирует ключ в новый разделитель; если
+// это копирование бросает исключение, а слить листья нельзя, лист остается
+// недозаполненным, но не пустым. Поиски, select, rank и итерация зависят
+// только от порядка ключей, разделителей и размеров поддеревьев, так что
+// такие листья работают как обычные; высоту задают внутренние вершины, а их
+// заполненность восстанавливается без копирований.
+template <typename Data_type, typename Node_type, typename Get, typename Tag = default_tag,
+          typename Compare = std::less<Data_type>, typename Allocator = std::allocator<Node_type>>
+class btree {
+  static_assert(std::is_base_of_v<btree_element<Tag>, Node_type>, "Node_type must derive from btree_element");
+  static_assert(std::is_nothrow_move_constructible_v<Data_type> && std::is_nothrow_move_assignable_v<Data_type>,
+                "Data_type must be nothrow movable");
+
+  using element = btree_element<Tag>;
+
+  // Вершина занимает около node_bytes байт, то есть несколько соседних
+  // кеш-линий, которые процессор подгружает параллельно.
+  static constexpr std::size_t node_bytes = 512;
+  static constexpr std::uint32_t leaf_capacity =
+      std::clamp<std::size_t>(node_bytes / (sizeof(Data_type) + sizeof(Node_type*)), 4, 64);
+  static constexpr std::uint32_t inner_capacity =
+      std::clamp<std::size_t>(node_bytes / (sizeof(Data_type) + sizeof(void*) + sizeof(std::size_t)), 4, 64);
+  static constexpr std::uint32_t leaf_min = leaf_capacity / 2;
+  static constexpr std::uint32_t inner_min = inner_capacity / 2;
+  static constexpr std::size_t max_height = 64;
+  static constexpr std::size_t batch_width = 16;
+
+  struct inner;
+
+  struct node_base {
+    inner* parent = nullptr;
+    std::uint32_t index = 0;
+  };
+
+  struct alignas(64) leaf : btree_link, node_base {
+    Data_type keys[leaf_capacity];
+    Node_type* items[leaf_capacity];
+  };
+
+  // keys[i] при i > 0 -- разделитель: больше всех ключей в children[i - 1]
+  // и не больше ключей в children[i]. sizes[i] -- число элементов в children[i].
+  struct alignas(64) inner : node_base {
+    std::uint32_t count = 0;
+    Data_type keys[inner_capacity];
+    node_base* children[inner_capacity];
+    std::size_t sizes[inner_capacity];
+  };
+
+  struct head_link : btree_link {
+    element* head = nullptr;
+  };
+
+  using leaf_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<leaf>;
+  using leaf_traits = std::allocator_traits<leaf_allocator>;
+  using inner_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<inner>;
+  using inner_traits = std::allocator_traits<inner_allocator>;
+
+  static element* hook(Node_type* node) noexcept {
+    return static_cast<element*>(node);
+  }
+
+  static element* next_element(element* cur) noexcept {
+    btree_link* link = cur->leaf;
+    std::uint32_t slot = cur->slot + 1;
+    if (link->count == 0 || slot == link->count) {
+      link = link->next;
+      slot = 0;
+    }
+    if (link->count == 0) {
+      return static_cast<head_link*>(link)->head;
+    }
+    return hook(static_cast<leaf*>(link)->items[slot]);
+  }
+
+  static element* prev_element(element* cur) noexcept {
+    btree_link* link = cur->leaf;
+    if (link->count != 0 && cur->slot != 0) {
+      return hook(static_cast<leaf*>(link)->items[cur->slot - 1]);
+    }
+    link = link->prev;
+    if (link->count == 0) {
+      return static_cast<head_link*>(link)->head;
+    }
+    return hook(static_cast<leaf*>(link)->items[link->count - 1]);
+  }
+
+  template <class E>
+  struct tree_iterator {
+    using value_type = Node_type;
+    using reference = E&;
+    using pointer = E*;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::bidirectional_iterator_tag;
+    friend btree;
+    tree_iterator() = default;
+
+    tree_iterator(element* elem) : _elem(elem) {}
+
+    tree_iterator& operator++() {
+      _elem = next_element(_elem);
+      return *this;
+    }
+
+    tree_iterator operator++(int) {
+      tree_iterator temp = *this;
+      ++*this;
+      return temp;
+    }
+
+    tree_iterator& operator--() {
+      _elem = prev_element(_elem);
+      return *this;
+    }
+
+    tree_iterator operator--(int) {
+      tree_iterator temp = *this;
+      --*this;
+      return temp;
+    }
+
+    pointer operator->() const {
+      return static_cast<E*>(_elem);
+    }
+
+    friend bool operator==(const tree_iterator& a, const tree_iterator& b) {
+      return (a._elem == b._elem);
+    }
+
+    friend bool operator!=(const tree_iterator& a, const tree_iterator& b) {
+      return !(a == b);
+    }
+
+    reference operator*() const {
+      return *static_cast<E*>(_elem);
+    }
+
+    operator tree_iterator<const E>() const {
+      return tree_iterator<const E>(_elem);
+    }
+
+    bool is_end() const {
+      return _elem->leaf->count == 0;
+    }
+
+    element* get_by_element() const {
+      return _elem;
+    }
+
+  private:
+    element* _elem;
+  };
+
+public:
+  using iterator = tree_iterator<Node_type>;
+  using const_iterator = tree_iterator<const Node_type>;
+
+  btree(element* head, Compare&& input_comp, const Allocator& alloc = Allocator())
+      : comparator(std::move(input_comp)),
+        leaves_alloc(alloc),
+        inners_alloc(alloc) {
+    attach_head(head);
+  }
+
+  btree(element* head, btree&& other) noexcept
+      : comparator(std::move(other.comparator)),
+        leaves_alloc(other.leaves_alloc),
+        inners_alloc(other.inners_alloc) {
+    attach_head(head);
+    std::swap(root, other.root);
+    std::swap(height, other.height);
+    std::swap(elements, other.elements);
+    swap_rings(ring, other.ring);
+  }
+
+  btree(const btree&) = delete;
+  btree& operator=(const btree&) = delete;
+
+  ~btree() {
+    clear();
+  }
+
+  bool empty() const noexcept {
+    return root == nullptr;
+  }
+
+  std::size_t size() const noexcept {
+    return elements;
+  }
+
+  // Освобождает вершины дерева, не трогая элементы.
+  void clear() noexcept {
+    if (root != nullptr) {
+      free_subtree(root, height);
+    }
+    root = nullptr;
+    height = 0;
+    elements = 0;
+    ring.prev = &ring;
+    ring.next = &ring;
+  }
+
+  // Отцепляет все элементы за O(n) и передает каждый в dispose(Node_type*).
+  template <typename F>
+  void clear(F dispose) noexcept {
+    for (btree_link* link = ring.next; link != &ring; link = link->next) {
+      leaf* lf = static_cast<leaf*>(link);
+      for (std::uint32_t i = 0; i < lf->count; i++) {
+        hook(lf->items[i])->leaf = nullptr;
+        dispose(lf->items[i]);
+      }
+    }
+    clear();
+  }
+
+  iterator begin() const noexcept {
+    return iterator(next_element(ring.head));
+  }
+
+  iterator end() const noexcept {
+    return iterator(ring.head);
+  }
+
+  // Строит дерево из вершин [first, last), уже упорядоченных по возрастанию
+  // ключей без повторов. Дерево должно быть пустым. Листья заполняются
+  // целиком. Если выделение памяти бросает исключение, дерево содержит
+  // префикс диапазона.
+  template <typename RandomIt>
+  void build_sorted(RandomIt first, RandomIt last) {
+    for (; first != last; ++first) {
+      Node_type* value = *first;
+      insert(end_position(), value);
+    }
+  }
+
+  void swap(btree& other) noexcept {
+    std::swap(root, other.root);
+    std::swap(height, other.height);
+    std::swap(elements, other.elements);
+    swap_rings(ring, other.ring);
+    std::swap(leaves_alloc, other.leaves_alloc);
+    std::swap(inners_alloc, other.inners_alloc);
+  }
+
+  // Место для вставки нового элемента: лист и номер в нем. Если равный
+  // элемент уже есть, occupied() == true, а get() указывает на него.
+  class insert_position {
+    friend btree;
+
+  public:
+    bool occupied() const noexcept {
+      return found;
+    }
+
+    iterator get() const noexcept {
+      return iterator(hook(where->items[slot]));
+    }
+
+  private:
+    insert_position(leaf* where, std::uint32_t slot, bool found) : where(where), slot(slot), found(found) {}
+
+    leaf* where;
+    std::uint32_t slot;
+    bool found;
+  };
+
+  insert_position find_position(const Data_type& value) const {
+    auto probe = counters.start(operation::insert);
+    return find_position(value, probe);
+  }
+
+  // Как find_position, но сначала проверяет, нельзя ли вставить value
+  // непосредственно перед hint. Если подсказка верна, делает O(1) сравнений.
+  insert_position find_position(iterator hint, const Data_type& value) const {
+    auto probe = counters.start(operation::insert);
+    if (empty()) {
+      return find_position(value, probe);
+    }
+    if (hint.is_end()) {
+      leaf* last = static_cast<leaf*>(ring.prev);
+      if (less(probe, last->keys[last->count - 1], value)) {
+        return {last, last->count, false};
+      }
+      return find_position(value, probe);
+    }
+    leaf* lf = static_cast<leaf*>(hint._elem->leaf);
+    std::uint32_t slot = hint._elem->slot;
+    if (less(probe, value, lf->keys[slot])) {
+      if (slot != 0) {
+        if (less(probe, lf->keys[slot - 1], value)) {
+          return {lf, slot, false};
+        }
+        return find_position(value, probe);
+      }
+      if (lf->prev == &ring) {
+        return {lf, 0, false};
+      }
+      leaf* before = static_cast<leaf*>(lf->prev);
+      if (!less(probe, before->keys[before->count - 1], value)) {
+        return find_position(value, probe);
+      }
+      // value лежит между листами: кладем его туда, куда ведет разделитель.
+      if (less(probe, value, separator(lf))) {
+        return {before, before->count, false};
+      }
+      return {lf, 0, false};
+    }
+    if (!less(probe, lf->keys[slot], value)) {
+      return {lf, slot, true};
+    }
+    return find_position(value, probe);
+  }
+
+  // Элемент, перед которым встанет значение, вставленное в pos, или end().
+  // Вынимание других элементов его не меняет, поэтому он годится подсказкой
+  // для find_position после таких изменений.
+  iterator successor(insert_position pos) const noexcept {
+    return pos.where == nullptr ? end() : at(pos.where, pos.slot);
+  }
+
+  iterator insert(Node_type* value) {
+    auto pos = find_position(Get::get(*value));
+    return pos.occupied() ? end() : insert(pos, value);
+  }
+
+  // Кладет value в место, найденное find_position для ключа value.
+  // Между поиском места и вставкой дерево не должно меняться.
+  iterator insert(insert_position pos, Node_type* value) {
+    Data_type key(Get::get(*value));
+    if (empty()) {
+      leaf* lf = new_leaf();
+      link_leaf_after(lf, &ring);
+      root = lf;
+      height = 1;
+      pos = {lf, 0, false};
+    }
+    leaf* lf = pos.where;
+    std::uint32_t slot = pos.slot;
+    if (lf->count == leaf_capacity) {
+      lf = split_leaf(lf, slot, key);
+    }
+    put(lf, slot, value, std::move(key));
+    elements++;
+    inc_path(lf);
+    return iterator(hook(value));
+  }
+
+  // Методы поиска принимают любой ключ K, сравнимый с Data_type при помощи
+  // Compare. Проверять, что Compare прозрачный, должен вызывающий код.
+  template <typename K>
+  iterator lower_bound(const K& value) const {
+    auto probe = counters.start(operation::bound);
+    if (empty()) {
+      return end();
+    }
+    leaf* lf = find_leaf(value, nullptr, probe);
+    return at(lf, leaf_lower_bound(lf, value, probe));
+  }
+
+  template <typename K>
+  iterator upper_bound(const K& value) const {
+    auto probe = counters.start(operation::bound);
+    if (empty()) {
+      return end();
+    }
+    leaf* lf = find_leaf(value, nullptr, probe);
+    return at(lf, leaf_upper_bound(lf, value, probe));
+  }
+
+  template <typename K>
+  iterator find(const K& value) const {
+    auto probe = counters.start(operation::find);
+    if (empty()) {
+      return end();
+    }
+    leaf* lf = find_leaf(value, nullptr, probe);
+    std::uint32_t slot = leaf_lower_bound(lf, value, probe);
+    if (slot < lf->count && !less(probe, value, lf->keys[slot])) {
+      return iterator(hook(lf->items[slot]));
+    }
+    return end();
+  }
+
+  // Ищет keys[0], ..., keys[count - 1] и для каждого i вызывает
+  // report(i, iterator) с найденным элементом или end(). Спуски группы из
+  // batch_width ключей идут по уровням вместе: пока ищется сын в одной
+  // вершине, ключи вершин следующего уровня других спусков уже грузятся.
+  template <typename K, typename F>
+  void find_batch(const K* keys, std::size_t count, F&& report) const {
+    auto probe = counters.start(operation::find, count);
+    for (std::size_t first = 0; first < count; first += batch_width) {
+      std::size_t width = std::min(batch_width, count - first);
+      if (empty()) {
+        for (std::size_t i = 0; i < width; i++) {
+          report(first + i, end());
+        }
+        continue;
+      }
+      node_base* cur_nodes[batch_width];
+      for (std::size_t i = 0; i < width; i++) {
+        cur_nodes[i] = root;
+      }
+      for (std::size_t level = height; level > 1; level--) {
+        for (std::size_t i = 0; i < width; i++) {
+          inner* in = static_cast<inner*>(cur_nodes[i]);
+          probe.step();
+          cur_nodes[i] = in->children[child_index(in, keys[first + i], probe)];
+          if (level > 2) {
+            prefetch_keys(static_cast<inner*>(cur_nodes[i])->keys, inner_capacity);
+          } else {
+            prefetch_keys(static_cast<leaf*>(cur_nodes[i])->keys, leaf_capacity);
+          }
+        }
+      }
+      for (std::size_t i = 0; i < width; i++) {
+        leaf* lf = static_cast<leaf*>(cur_nodes[i]);
+        probe.step();
+        std::uint32_t slot = leaf_lower_bound(lf, keys[first + i], probe);
+        bool found = slot < lf->count && !less(probe, keys[first + i], lf->keys[slot]);
+        report(first + i, found ? iterator(hook(lf->items[slot])) : end());
+      }
+    }
+  }
+
+  // Элемент с номером index по порядку (с нуля) или end(), если index >= size().
+  iterator select(std::size_t index) const noexcept {
+    if (index >= size()) {
+      return end();
+    }
+    node_base* cur_node = root;
+    for (std::size_t level = height; level > 1; level--) {
+      inner* in = static_cast<inner*>(cur_node);
+      std::uint32_t child = 0;
+      for (; index >= in->sizes[child]; child++) {
+        index -= in->sizes[child];
+      }
+      cur_node = in->children[child];
+    }
+    return iterator(hook(static_cast<leaf*>(cur_node)->items[index]));
+  }
+
+  // Количество элементов, строго меньших value.
+  template <typename K>
+  std::size_t rank(const K& value) const {
+    auto probe = counters.start(operation::rank);
+    if (empty()) {
+      return 0;
+    }
+    std::size_t res = 0;
+    leaf* lf = find_leaf(value, &res, probe);
+    return res + leaf_lower_bound(lf, value, probe);
+  }
+
+  // Номер элемента pos по порядку, size() для end().
+  std::size_t rank(iterator pos) const noexcept {
+    if (pos.is_end()) {
+      return size();
+    }
+    std::size_t res = pos._elem->slot;
+    for (node_base* cur_node = static_cast<leaf*>(pos._elem->leaf); cur_node->parent != nullptr;
+         cur_node = cur_node->parent) {
+      for (std::uint32_t i = 0; i < cur_node->index; i++) {
+        res += cur_node->parent->sizes[i];
+      }
+    }
+    return res;
+  }
+
+  Node_type* get_node(iterator pos) {
+    return static_cast<Node_type*>(pos._elem);
+  }
+
+  Node_type* erase(iterator pos) noexcept {
+    element* elem = pos._elem;
+    leaf* lf = static_cast<leaf*>(elem->leaf);
+    Node_type* res = lf->items[elem->slot];
+    for (std::uint32_t i = elem->slot + 1; i < lf->count; i++) {
+      move_entry(lf, i, lf, i - 1);
+    }
+    lf->count--;
+    elements--;
+    dec_path(lf);
+    elem->leaf = nullptr;
+    elem->slot = 0;
+    fix_leaf(lf);
+    return res;
+  }
+
+  // Вынимает из дерева элементы [first, last) и передает каждый в
+  // dispose(Node_type*). Возвращает количество вынутых элементов.
+  template <typename F>
+  std::size_t erase(iterator first, iterator last, F dispose) noexcept {
+    std::size_t res = 0;
+    for (element* cur = first._elem; cur != last._elem; res++) {
+      element* next = next_element(cur);
+      dispose(erase(iterator(cur)));
+      cur = next;
+    }
+    return res;
+  }
+
+  const Compare& get_comp() const {
+    return comparator;
+  }
+
+  // Форма дерева и накопленные счетчики. Все элементы лежат в листьях, так
+  // что глубина любого из них равна высоте.
+  tree_stats stats() const noexcept {
+    tree_stats res;
+    res.size = size();
+    res.height = height;
+    res.max_depth = height;
+    res.average_depth = static_cast<double>(height);
+    res.allocations = allocations.get_allocations();
+    res.deallocations = allocations.get_deallocations();
+    counters.fill(res);
+    return res;
+  }
+
+private:
+  // Вершины, выделенные до начала вставки, чтобы разбиения не могли
+  // бросить исключение посреди перестройки. Невостребованные освобождаются.
+  struct spare_nodes {
+    explicit spare_nodes(btree& owner) : owner(owner) {}
+
+    spare_nodes(const spare_nodes&) = delete;
+    spare_nodes& operator=(const spare_nodes&) = delete;
+
+    ~spare_nodes() {
+      if (lf != nullptr) {
+        owner.delete_leaf(lf);
+      }
+      for (std::size_t i = 0; i < count; i++) {
+        owner.delete_inner(inners[i]);
+      }
+    }
+
+    inner* take_inner() noexcept {
+      return inners[--count];
+    }
+
+    btree& owner;
+    leaf* lf{nullptr};
+    inner* inners[max_height];
+    std::size_t count{0};
+  };
+
+  void attach_head(element* head) noexcept {
+    ring.head = head;
+    head->leaf = &ring;
+    head->slot = 0;
+  }
+
+  static void swap_rings(head_link& lhs, head_link& rhs) noexcept {
+    btree_link* lhs_first = lhs.next;
+    btree_link* lhs_last = lhs.prev;
+    relink_ring(lhs, rhs.next == &rhs ? nullptr : rhs.next, rhs.prev);
+    relink_ring(rhs, lhs_first == &lhs ? nullptr : lhs_first, lhs_last);
+  }
+
+  static void relink_ring(head_link& head, btree_link* first, btree_link* last) noexcept {
+    if (first == nullptr) {
+      head.next = &head;
+      head.prev = &head;
+      return;
+    }
+    head.next = first;
+    first->prev = &head;
+    head.prev = last;
+    last->next = &head;
+  }
+
+  static void link_leaf_after(leaf* lf, btree_link* pos) noexcept {
+    lf->prev = pos;
+    lf->next = pos->next;
+    pos->next->prev = lf;
+    pos->next = lf;
+  }
+
+  static void unlink_leaf(leaf* lf) noexcept {
+    lf->prev->next = lf->next;
+    lf->next->prev = lf->prev;
+  }
+
+  leaf* new_leaf() {
+    leaf* res = leaf_traits::allocate(leaves_alloc, 1);
+    try {
+      leaf_traits::construct(leaves_alloc, res);
+    } catch (...) {
+      leaf_traits::deallocate(leaves_alloc, res, 1);
+      throw;
+    }
+    allocations.allocated();
+    return res;
+  }
+
+  inner* new_inner() {
+    inner* res = inner_traits::allocate(inners_alloc, 1);
+    try {
+      inner_traits::construct(inners_alloc, res);
+    } catch (...) {
+      inner_traits::deallocate(inners_alloc, res, 1);
+      throw;
+    }
+    allocations.allocated();
+    return res;
+  }
+
+  void delete_leaf(leaf* lf) noexcept {
+    leaf_traits::destroy(leaves_alloc, lf);
+    leaf_traits::deallocate(leaves_alloc, lf, 1);
+    allocations.deallocated();
+  }
+
+  void delete_inner(inner* in) noexcept {
+    inner_traits::destroy(inners_alloc, in);
+    inner_traits::deallocate(inners_alloc, in, 1);
+    allocations.deallocated();
+  }
+
+  void free_subtree(node_base* node, std::size_t level) noexcept {
+    if (level == 1) {
+      delete_leaf(static_cast<leaf*>(node));
+      return;
+    }
+    inner* in = static_cast<inner*>(node);
+    for (std::uint32_t i = 0; i < in->count; i++) {
+      free_subtree(in->children[i], level - 1);
+    }
+    delete_inner(in);
+  }
+
+  insert_position end_position() const noexcept {
+    if (empty()) {
+      return {nullptr, 0, false};
+    }
+    leaf* last = static_cast<leaf*>(ring.prev);
+    return {last, last->count, false};
+  }
+
+  iterator at(leaf* lf, std::uint32_t slot) const noexcept {
+    if (slot < lf->count) {
+      return iterator(hook(lf->items[slot]));
+    }
+    if (lf->next == &ring) {
+      return end();
+    }
+    return iterator(hook(static_cast<leaf*>(lf->next)->items[0]));
+  }
+
+  // Разделитель, отделяющий лист lf от предыдущего. lf не должен быть первым.
+  static const Data_type& separator(const leaf* lf) noexcept {
+    const node_base* cur_node = lf;
+    while (cur_node->index == 0) {
+      cur_node = cur_node->parent;
+    }
+    return cur_node->parent->keys[cur_node->index];
+  }
+
+  template <typename Probe, typename A, typename B>
+  bool less(Probe& probe, const A& lhs, const B& rhs) const {
+    probe.compare();
+    return comparator(lhs, rhs);
+  }
+
+  template <typename Probe>
+  insert_position find_position(const Data_type& value, Probe& probe) const {
+    if (empty()) {
+      return {nullptr, 0, false};
+    }
+    leaf* lf = find_leaf(value, nullptr, probe);
+    std::uint32_t slot = leaf_lower_bound(lf, value, probe);
+    return {lf, slot, slot < lf->count && !less(probe, value, lf->keys[slot])};
+  }
+
+  template <typename K, typename Probe>
+  std::uint32_t leaf_lower_bound(const leaf* lf, const K& value, Probe& probe) const {
+    std::uint32_t first = 0;
+    for (std::uint32_t len = lf->count; len > 0;) {
+      std::uint32_t half = len / 2;
+      if (less(probe, lf->keys[first + half], value)) {
+        first += half + 1;
+        len -= half + 1;
+      } else {
+        len = half;
+      }
+    }
+    return first;
+  }
+
+  template <typename K, typename Probe>
+  std::uint32_t leaf_upper_bound(const leaf* lf, const K& value, Probe& probe) const {
+    std::uint32_t first = 0;
+    for (std::uint32_t len = lf->count; len > 0;) {
+      std::uint32_t half = len / 2;
+      if (!less(probe, value, lf->keys[first + half])) {
+        first += half + 1;
+        len -= half + 1;
+      } else {
+        len = half;
+      }
+    }
+    return first;
+  }
+
+  // Номер сына in, в поддереве которого лежат ключи, равные value.
+  template <typename K, typename Probe>
+  std::uint32_t child_index(const inner* in, const K& value, Probe& probe) const {
+    std::uint32_t first = 1;
+    for (std::uint32_t len = in->count - 1; len > 0;) {
+      std::uint32_t half = len / 2;
+      if (!less(probe, value, in->keys[first + half])) {
+        first += half + 1;
+        len -= half + 1;
+      } else {
+        len = half;
+      }
+    }
+    return first - 1;
+  }
+
+  // Спускается к листу, в котором лежат ключи, равные value. Если rank не
+  // nullptr, прибавляет к нему число элементов в поддеревьях левее пути.
+  template <typename K, typename Probe>
+  leaf* find_leaf(const K& value, std::size_t* rank, Probe& probe) const {
+    node_base* cur_node = root;
+    for (std::size_t level = height; level > 1; level--) {
+      inner* in = static_cast<inner*>(cur_node);
+      prefetch_keys(in->keys, in->count);
+      probe.step();
+      std::uint32_t child = child_index(in, value, probe);
+      if (rank != nullptr) {
+        for (std::uint32_t i = 0; i < child; i++) {
+          *rank += in->sizes[i];
+        }
+      }
+      cur_node = in->children[child];
+    }
+    leaf* lf = static_cast<leaf*>(cur_node);
+    prefetch_keys(lf->keys, lf->count);
+    probe.step();
+    return lf;
+  }
+
+  // Запрашивает все кеш-линии ключей вершины разом: двоичный поиск по ним
+  // дальше не ждет каждую линию по очереди.
+  static void prefetch_keys(const Data_type* keys, std::uint32_t count) noexcept {
+    const char* first = reinterpret_cast<const char*>(keys);
+    const char* last = reinterpret_cast<const char*>(keys + count);
+    for (; first < last; first += 64) {
+      prefetch(first);
+    }
+  }
+
+  static void inc_path(node_base* node) noexcept {
+    for (; node->parent != nullptr; node = node->parent) {
+      node->parent->sizes[node->index]++;
+    }
+  }
+
+  static void dec_path(node_base* node) noexcept {
+    for (; node->parent != nullptr; node = node->parent) {
+      node->parent->sizes[node->index]--;
+    }
+  }
+
+  static std::size_t subtree_size(node_base* node, bool is_leaf) noexcept {
+    if (is_leaf) {
+      return static_cast<leaf*>(node)->count;
+    }
+    inner* in = static_cast<inner*>(node);
+    std::size_t res = 0;
+    for (std::uint32_t i = 0; i < in->count; i++) {
+      res += in->sizes[i];
+    }
+    return res;
+  }
+
+  static void move_entry(leaf* from, std::uint32_t from_slot, leaf* to, std::uint32_t to_slot) noexcept {
+    to->keys[to_slot] = std::move(from->keys[from_slot]);
+    to->items[to_slot] = from->items[from_slot];
+    element* elem = hook(to->items[to_slot]);
+    elem->leaf = to;
+    elem->slot = to_slot;
+  }
+
+  static void move_child(inner* from, std::uint32_t from_index, inner* to, std::uint32_t to_index) noexcept {
+    to->children[to_index] = from->children[from_index];
+    to->sizes[to_index] = from->sizes[from_index];
+    to->children[to_index]->parent = to;
+    to->children[to_index]->index = to_index;
+  }
+
+  static void put(leaf* lf, std::uint32_t slot, Node_type* value, Data_type&& key) noexcept {
+    for (std::uint32_t i = lf->count; i > slot; i--) {
+      move_entry(lf, i - 1, lf, i);
+    }
+    lf->keys[slot] = std::move(key);
+    lf->items[slot] = value;
+    hook(value)->leaf = lf;
+    hook(value)->slot = slot;
+    lf->count++;
+  }
+
+  // Делит полный лист lf перед вставкой ключа key на место slot. Возвращает
+  // лист, в который нужно вставлять, и исправляет slot. При вставке в конец
+  // последнего листа новый лист начинается пустым, так что вставки по
+  // возрастанию заполняют листья целиком.
+  leaf* split_leaf(leaf* lf, std::uint32_t& slot, const Data_type& key) {
+    bool append = slot == lf->count && lf->next == &ring;
+    spare_nodes spare(*this);
+    spare.lf = new_leaf();
+    // Полные предки делятся вместе с листом, а если делится корень,
+    // нужен еще новый корень.
+    std::size_t needed = 0;
+    inner* cur_node = lf->parent;
+    for (; cur_node != nullptr && cur_node->count == inner_capacity; cur_node = cur_node->parent) {
+      needed++;
+    }
+    needed += (cur_node == nullptr);
+    for (; spare.count < needed; spare.count++) {
+      spare.inners[spare.count] = new_inner();
+    }
+    std::uint32_t mid = append ? lf->count : lf->count / 2;
+    Data_type sep(append ? key : lf->keys[mid]);
+
+    leaf* right = std::exchange(spare.lf, nullptr);
+    for (std::uint32_t i = mid; i < lf->count; i++) {
+      move_entry(lf, i, right, i - mid);
+    }
+    right->count = lf->count - mid;
+    lf->count = mid;
+    link_leaf_after(right, lf);
+    insert_child(lf, right, std::move(sep), spare, true, append);
+    if (slot > mid || append) {
+      slot -= mid;
+      return right;
+    }
+    return lf;
+  }
+
+  // Подвешивает right_child сразу после left_child, разделив их ключом sep.
+  void insert_child(node_base* left_child, node_base* right_child, Data_type&& sep, spare_nodes& spare,
+                    bool is_leaf, bool append) noexcept {
+    inner* par = left_child->parent;
+    if (par == nullptr) {
+      inner* top = spare.take_inner();
+      top->count = 2;
+      top->children[0] = left_child;
+      top->children[1] = right_child;
+      top->keys[1] = std::move(sep);
+      top->sizes[0] = subtree_size(left_child, is_leaf);
+      top->sizes[1] = subtree_size(right_child, is_leaf);
+      left_child->parent = top;
+      left_child->index = 0;
+      right_child->parent = top;
+      right_child->index = 1;
+      root = top;
+      height++;
+      return;
+    }
+    if (par->count == inner_capacity) {
+      split_inner(par, spare, append);
+      par = left_child->parent;
+    }
+    std::uint32_t pos = left_child->index + 1;
+    for (std::uint32_t i = par->count; i > pos; i--) {
+      move_child(par, i - 1, par, i);
+      par->keys[i] = std::move(par->keys[i - 1]);
+    }
+    par->keys[pos] = std::move(sep);
+    par->children[pos] = right_child;
+    par->sizes[pos] = subtree_size(right_child, is_leaf);
+    par->sizes[pos - 1] = subtree_size(left_child, is_leaf);
+    right_child->parent = par;
+    right_child->index = pos;
+    par->count++;
+  }
+
+  void split_inner(inner* in, spare_nodes& spare, bool append) noexcept {
+    inner* right = spare.take_inner();
+    std::uint32_t mid = append ? in->count - 1 : in->count / 2;
+    Data_type sep(std::move(in->keys[mid]));
+    for (std::uint32_t i = mid; i < in->count; i++) {
+      move_child(in, i, right, i - mid);
+      if (i > mid) {
+        right->keys[i - mid] = std::move(in->keys[i]);
+      }
+    }
+    right->count = in->count - mid;
+    in->count = mid;
+    insert_child(in, right, std::move(sep), spare, false, append);
+  }
+
+  // Восстанавливает заполненность листа после удаления из него элемента.
+  // Если заимствование не удалось из-за копирования разделителя, а сумма с
+  // соседом не помещается в лист, lf остается недозаполненным. Пустым он
+  // остаться не может: пустой лист помещается в любого соседа и сливается.
+  void fix_leaf(leaf* lf) noexcept {
+    if (lf->parent == nullptr) {
+      if (lf->count == 0) {
+        unlink_leaf(lf);
+        delete_leaf(lf);
+        root = nullptr;
+        height = 0;
+      }
+      return;
+    }
+    if (lf->count >= leaf_min) {
+      return;
+    }
+    inner* par = lf->parent;
+    leaf* before = lf->index > 0 ? static_cast<leaf*>(par->children[lf->index - 1]) : nullptr;
+    leaf* after = lf->index + 1 < par->count ? static_cast<leaf*>(par->children[lf->index + 1]) : nullptr;
+    if (before != nullptr && before->count > leaf_min && borrow_from_left(before, lf)) {
+      return;
+    }
+    if (after != nullptr && after->count > leaf_min && borrow_from_right(lf, after)) {
+      return;
+    }
+    if (before != nullptr && before->count + lf->count <= leaf_capacity) {
+      merge_leaves(before, lf);
+    } else if (after != nullptr && lf->count + after->count <= leaf_capacity) {
+      merge_leaves(lf, after);
+    }
+  }
+
+  // Перекладывает последний элемент before в начало lf. Новый разделитель
+  // -- копия ключа; если копирование бросает исключение, ничего не меняет и
+  // возвращает false.
+  bool borrow_from_left(leaf* before, leaf* lf) noexcept {
+    try {
+      Data_type sep(before->keys[before->count - 1]);
+      for (std::uint32_t i = lf->count; i > 0; i--) {
+        move_entry(lf, i - 1, lf, i);
+      }
+      move_entry(before, before->count - 1, lf, 0);
+      before->count--;
+      lf->count++;
+      inner* par = lf->parent;
+      par->keys[lf->index] = std::move(sep);
+      par->sizes[lf->index - 1]--;
+      par->sizes[lf->index]++;
+    } catch (...) {
+      return false;
+    }
+    return true;
+  }
+
+  bool borrow_from_right(leaf* lf, leaf* after) noexcept {
+    try {
+      Data_type sep(after->keys[1]);
+      move_entry(after, 0, lf, lf->count);
+      for (std::uint32_t i = 1; i < after->count; i++) {
+        move_entry(after, i, after, i - 1);
+      }
+      after->count--;
+      lf->count++;
+      inner* par = lf->parent;
+      par->keys[after->index] = std::move(sep);
+      par->sizes[lf->index]++;
+      par->sizes[after->index]--;
+    } catch (...) {
+      return false;
+    }
+    return true;
+  }
+
+  void merge_leaves(leaf* lhs, leaf* rhs) noexcept {
+    for (std::uint32_t i = 0; i < rhs->count; i++) {
+      move_entry(rhs, i, lhs, lhs->count + i);
+    }
+    lhs->count += rhs->count;
+    inner* par = lhs->parent;
+    par->sizes[lhs->index] += par->sizes[rhs->index];
+    remove_child(par, rhs->index);
+    unlink_leaf(rhs);
+    delete_leaf(rhs);
+    fix_inner(par);
+  }
+
+  static void remove_child(inner* in, std::uint32_t index) noexcept {
+    for (std::uint32_t i = index + 1; i < in->count; i++) {
+      move_child(in, i, in, i - 1);
+      in->keys[i - 1] = std::move(in->keys[i]);
+    }
+    in->count--;
+  }
+
+  void fix_inner(inner* in) noexcept {
+    if (in->parent == nullptr) {
+      if (in->count == 1) {
+        root = in->children[0];
+        root->parent = nullptr;
+        root->index = 0;
+        height--;
+        delete_inner(in);
+      }
+      return;
+    }
+    if (in->count >= inner_min) {
+      return;
+    }
+    inner* par = in->parent;
+    inner* before = in->index > 0 ? static_cast<inner*>(par->children[in->index - 1]) : nullptr;
+    inner* after = in->index + 1 < par->count ? static_cast<inner*>(par->children[in->index + 1]) : nullptr;
+    if (before != nullptr && before->count > inner_min) {
+      rotate_from_left(before, in);
+    } else if (after != nullptr && after->count > inner_min) {
+      rotate_from_right(in, after);
+    } else if (before != nullptr) {
+      merge_inners(before, in);
+    } else {
+      merge_inners(in, after);
+    }
+  }
+
+  static void rotate_from_left(inner* before, inner* in) noexcept {
+    inner* par = in->parent;
+    for (std::uint32_t i = in->count; i > 0; i--) {
+      move_child(in, i - 1, in, i);
+      if (i > 1) {
+        in->keys[i] = std::move(in->keys[i - 1]);
+      }
+    }
+    in->keys[1] = std::move(par->keys[in->index]);
+    move_child(before, before->count - 1, in, 0);
+    par->keys[in->index] = std::move(before->keys[before->count - 1]);
+    par->sizes[before->index] -= in->sizes[0];
+    par->sizes[in->index] += in->sizes[0];
+    before->count--;
+    in->count++;
+  }
+
+  static void rotate_from_right(inner* in, inner* after) noexcept {
+    inner* par = in->parent;
+    in->keys[in->count] = std::move(par->keys[after->index]);
+    move_child(after, 0, in, in->count);
+    par->keys[after->index] = std::move(after->keys[1]);
+    par->sizes[in->index] += in->sizes[in->count];
+    par->sizes[after->index] -= in->sizes[in->count];
+    in->count++;
+    for (std::uint32_t i = 1; i < after->count; i++) {
+      move_child(after, i, after, i - 1);
+      if (i > 1) {
+        after->keys[i - 1] = std::move(after->keys[i]);
+      }
+    }
+    after->count--;
+  }
+
+  void merge_inners(inner* lhs, inner* rhs) noexcept {
+    inner* par = lhs->parent;
+    lhs->keys[lhs->count] = std::move(par->keys[rhs->index]);
+    for (std::uint32_t i = 0; i < rhs->count; i++) {
+      move_child(rhs, i, lhs, lhs->count + i);
+      if (i > 0) {
+        lhs->keys[lhs->count + i] = std::move(rhs->keys[i]);
+      }
+    }
+    lhs->count += rhs->count;
+    par->sizes[lhs->index] += par->sizes[rhs->index];
+    remove_child(par, rhs->index);
+    delete_inner(rhs);
+    fix_inner(par);
+  }
+
+  [[no_unique_address]] Compare comparator;
+  [[no_unique_address]] leaf_allocator leaves_alloc;
+  [[no_unique_address]] inner_allocator inners_alloc;
+  head_link ring;
+  node_base* root{nullptr};
+  std::size_t height{0};
+  std::size_t elements{0};
+  [[no_unique_address]] operation_counters<> counters;
+  [[no_unique_address]] allocation_counters<> allocations;
+};
+
+// Политика индекса bimap: обе стороны хранятся в B+-деревьях.
+struct btree_policy {
+  template <typename Tag>
+  using element = btree_element<Tag>;
+
+  template <typename Data_type, typename Node_type, typename Get, typename Tag, typename Compare, typename Allocator>
+  using tree_type = btree<Data_type, Node_type, Get, Tag, Compare, Allocator>;
+};
+
+} // namespace intrusive
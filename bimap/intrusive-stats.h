@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace intrusive {
+
+// Счетчики горячих путей собираются, только если до подключения деревьев
+// определен макрос BIMAP_STATS. Иначе замеры -- пустые inline-функции, а
+// счетчики -- пустые члены с [[no_unique_address]], так что код спусков и
+// размеры контейнеров не меняются. Макрос должен быть одинаковым во всех
+// единицах трансляции программы.
+#if defined(BIMAP_STATS)
+inline constexpr bool collect_stats = true;
+#else
+inline constexpr bool collect_stats = false;
+#endif
+
+// Операции, для которых дерево ведет отдельные счетчики.
+enum class operation : std::size_t {
+  find,   // find и find_batch
+  bound,  // lower_bound и upper_bound
+  insert, // поиск места для вставки, в том числе с подсказкой
+  rank,   // rank по ключу
+};
+
+inline constexpr std::size_t operation_count = 4;
+
+struct operation_stats {
+  std::uint64_t calls = 0;
+  std::uint64_t comparisons = 0;
+  // Сколько вершин дерева прочитано спусками.
+  std::uint64_t descent = 0;
+};
+
+// Снимок одного дерева. Глубина элемента -- число вершин на пути от корня до
+// вершины, в которой он лежит, включая обе; height -- число уровней дерева.
+// allocations и deallocations считают собственные вершины индекса: у tree
+// вершины -- сами элементы, и эти счетчики всегда нулевые. Счетчики операций
+// и выделений ненулевые, только если определен BIMAP_STATS.
+struct tree_stats {
+  std::size_t size = 0;
+  std::size_t height = 0;
+  std::size_t max_depth = 0;
+  double average_depth = 0;
+  std::uint64_t allocations = 0;
+  std::uint64_t deallocations = 0;
+  operation_stats find;
+  operation_stats bound;
+  operation_stats insert;
+  operation_stats rank;
+};
+
+// Замер, который ничего не считает.
+struct null_probe {
+  void compare() noexcept {}
+
+  void step() noexcept {}
+};
+
+// Счетчики операций дерева. Операция берет замер через start, копит в нем
+// сравнения и шаги спуска на стеке, а при разрушении замер добавляет их к
+// общим счетчикам. Сложения атомарные и relaxed, так что поиски из разных
+// потоков (например, читателей concurrent_bimap) не гонятся за счетчики.
+template <bool Enabled = collect_stats>
+class operation_counters {
+  struct counters_line {
+    std::atomic<std::uint64_t> calls{0};
+    std::atomic<std::uint64_t> comparisons{0};
+    std::atomic<std::uint64_t> descent{0};
+  };
+
+public:
+  class probe {
+  public:
+    probe(const operation_counters& owner, operation op, std::uint64_t calls) noexcept
+        : line(owner.lines[static_cast<std::size_t>(op)]),
+          calls(calls) {}
+
+    probe(const probe&) = delete;
+    probe& operator=(const probe&) = delete;
+
+    ~probe() {
+      line.calls.fetch_add(calls, std::memory_order_relaxed);
+      line.comparisons.fetch_add(comparisons, std::memory_order_relaxed);
+      line.descent.fetch_add(descent, std::memory_order_relaxed);
+    }
+
+    void compare() noexcept {
+      comparisons++;
+    }
+
+    void step() noexcept {
+      descent++;
+    }
+
+  private:
+    counters_line& line;
+    std::uint64_t calls;
+    std::uint64_t comparisons{0};
+    std::uint64_t descent{0};
+  };
+
+  probe start(operation op, std::uint64_t calls = 1) const noexcept {
+    return probe(*this, op, calls);
+  }
+
+  void fill(tree_stats& res) const noexcept {
+    res.find = get(operation::find);
+    res.bound = get(operation::bound);
+    res.insert = get(operation::insert);
+    res.rank = get(operation::rank);
+  }
+
+private:
+  operation_stats get(operation op) const noexcept {
+    const counters_line& line = lines[static_cast<std::size_t>(op)];
+    return {line.calls.load(std::memory_order_relaxed), line.comparisons.load(std::memory_order_relaxed),
+            line.descent.load(std::memory_order_relaxed)};
+  }
+
+  mutable counters_line lines[operation_count];
+};
+
+template <>
+class operation_counters<false> {
+public:
+  using probe = null_probe;
+
+  probe start(operation, std::uint64_t = 1) const noexcept {
+    return {};
+  }
+
+  void fill(tree_stats&) const noexcept {}
+};
+
+// Счетчики выделений и освобождений памяти.
+template <bool Enabled = collect_stats>
+class allocation_counters {
+public:
+  void allocated() noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void deallocated() noexcept {
+    deallocations.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::uint64_t get_allocations() const noexcept {
+    return allocations.load(std::memory_order_relaxed);
+  }
+
+  std::uint64_t get_deallocations() const noexcept {
+    return deallocations.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<std::uint64_t> allocations{0};
+  std::atomic<std::uint64_t> deallocations{0};
+};
+
+template <>
+class allocation_counters<false> {
+public:
+  void allocated() noexcept {}
+
+  void deallocated() noexcept {}
+
+  std::uint64_t get_allocations() const noexcept {
+    return 0;
+  }
+
+  std::uint64_t get_deallocations() const noexcept {
+    return 0;
+  }
+};
+
+} // namespace intrusive
@@ -1,26 +1,48 @@
 #pragma once
 
+#include "intrusive-stats.h"
+
+#include <algorithm>
+#include <bit>
 #include <cstddef>
 #include <functional>
 #include <iterator>
+#include <limits>
 #include <type_traits>
 
 namespace intrusive {
 
 class default_tag;
 
+// Просит процессор заранее подгрузить кеш-линию с addr. Ничего не читает и
+// не может упасть на любом адресе.
+inline void prefetch(const void* addr) noexcept {
+#if defined(__GNUC__)
+  __builtin_prefetch(addr);
+#else
+  (void)addr;
+#endif
+}
+
 struct base_node {
   template <typename, typename, typename, typename, typename>
   friend class tree;
 
 public:
-  base_node() : left_son(this), right_son(this), parent(this) {}
+  base_node() : left_son(this), right_son(this), parent(this), prev(this), next(this) {}
 
   ~base_node() {
     del_link();
   }
 
-  base_node(base_node&& other) : left_son(other.left_son), right_son(other.right_son), parent(other.parent) {}
+  base_node(base_node&& other)
+      : left_son(other.left_son),
+        right_son(other.right_son),
+        parent(other.parent),
+        prev(other.prev),
+        next(other.next),
+        red(other.red),
+        subtree_size(other.subtree_size) {}
 
   base_node& operator=(base_node&& other) = default;
 
@@ -28,64 +50,28 @@ public:
   base_node& operator=(const base_node& other) = delete;
 
   void del_link() {
-    if (left_son == this && right_son == this) {
-      rem_from_parent();
-    } else if (right_son == this) {
-      replace(this, left_son);
-    } else if (left_son == this) {
-      replace(this, right_son);
-    } else {
-      base_node* temp = get_min_right();
-      if (temp->right_son == temp) {
-        temp->rem_from_parent();
-      } else {
-        replace(temp, temp->right_son);
-      }
-      link_l(left_son, temp);
-      if (right_son != this) {
-        link_r(right_son, temp);
-      }
-      replace(this, temp);
+    if (parent == this) {
+      unlink();
+      prev = this;
+      next = this;
+      return;
     }
-    unlink();
+    prev->next = next;
+    next->prev = prev;
+    prev = this;
+    next = this;
+    detach();
   }
 
-  base_node* get_next() {
-    base_node* cur_node = this;
-    if (cur_node->parent == cur_node) {
-      return get_most_left(cur_node->left_son);
-    }
-    if (cur_node->right_son != this) {
-      cur_node = get_most_left(cur_node->right_son);
-    } else {
-      if (cur_node->parent->left_son == cur_node) {
-        cur_node = cur_node->parent;
-      } else {
-        while (cur_node->parent->right_son == cur_node) {
-          cur_node = cur_node->parent;
-        }
-        cur_node = cur_node->parent;
-      }
-    }
-    return cur_node;
+  // Соседи по порядку хранятся в самих вершинах, поэтому переход к ним
+  // стоит одно чтение без подъемов по дереву. У sentinel next -- первый
+  // элемент, prev -- последний.
+  base_node* get_next() const noexcept {
+    return next;
   }
 
-  base_node* get_prev() {
-    base_node* cur_node = this;
-    if (cur_node->left_son != this) {
-      cur_node = cur_node->left_son;
-      while (cur_node->right_son != cur_node) {
-        cur_node = cur_node->right_son;
-      }
-    } else if (cur_node->parent->right_son == cur_node) {
-      cur_node = cur_node->parent;
-    } else {
-      while (cur_node->parent->left_son == cur_node) {
-        cur_node = cur_node->parent;
-      }
-      cur_node = cur_node->parent;
-    }
-    return cur_node;
+  base_node* get_prev() const noexcept {
+    return prev;
   }
 
   static base_node* get_most_left(base_node* node) {
@@ -96,19 +82,109 @@ public:
     return cur_node;
   }
 
-  base_node* get_min_right() {
-    base_node* cur_node = this;
-    if (cur_node->right_son != this) {
-      cur_node = cur_node->right_son;
-    }
-    cur_node = get_most_left(cur_node);
-    return cur_node;
+  bool has_left() const noexcept {
+    return left_son != this;
+  }
+
+  bool has_right() const noexcept {
+    return right_son != this;
+  }
+
+  std::size_t left_size() const noexcept {
+    return has_left() ? left_son->subtree_size : 0;
+  }
+
+  std::size_t right_size() const noexcept {
+    return has_right() ? right_son->subtree_size : 0;
   }
 
 private:
   base_node* left_son = this;
   base_node* right_son = this;
   base_node* parent = this;
+  // Элементы дерева вместе с sentinel образуют кольцевой список в порядке
+  // возрастания. Список поддерживают только insert, del_link и методы tree;
+  // структурные операции ниже (join, split, concat) его не трогают.
+  base_node* prev = this;
+  base_node* next = this;
+  // Цвет и размер поддерева делят одно слово, так что счетчики размеров
+  // не увеличивают узел. У sentinel subtree_size -- размер всего дерева.
+  std::size_t red : 1 = false;
+  std::size_t subtree_size : std::numeric_limits<std::size_t>::digits - 1 = 0;
+
+  // Вынимает вершину из дерева с перебалансировкой, не трогая список.
+  void detach() {
+    base_node* child;
+    base_node* child_parent;
+    bool removed_red;
+    if (!has_left() || !has_right()) {
+      child = has_left() ? left_son : (has_right() ? right_son : nullptr);
+      child_parent = parent;
+      removed_red = red;
+      dec_path(parent);
+      if (child != nullptr) {
+        replace(this, child);
+      } else {
+        rem_from_parent();
+      }
+    } else {
+      base_node* temp = get_most_left(right_son);
+      removed_red = temp->red;
+      child = temp->has_right() ? temp->right_son : nullptr;
+      dec_path(temp->parent);
+      if (temp->parent == this) {
+        child_parent = temp;
+      } else {
+        child_parent = temp->parent;
+        if (child != nullptr) {
+          link_l(child, temp->parent);
+        } else {
+          temp->parent->left_son = temp->parent;
+        }
+        link_r(right_son, temp);
+      }
+      link_l(left_son, temp);
+      replace(this, temp);
+      temp->red = red;
+      temp->subtree_size = subtree_size;
+    }
+    if (!removed_red) {
+      rebalance_after_erase(child, child_parent);
+    }
+    unlink();
+  }
+
+  void update_size() noexcept {
+    subtree_size = 1 + left_size() + right_size();
+  }
+
+  // Изменяет размеры поддеревьев от node вверх до sentinel включительно.
+  static void inc_path(base_node* node) noexcept {
+    for (;; node = node->parent) {
+      node->subtree_size++;
+      if (node->parent == node) {
+        break;
+      }
+    }
+  }
+
+  static void dec_path(base_node* node) noexcept {
+    for (;; node = node->parent) {
+      node->subtree_size--;
+      if (node->parent == node) {
+        break;
+      }
+    }
+  }
+
+  static void add_path(base_node* node, std::size_t delta) noexcept {
+    for (;; node = node->parent) {
+      node->subtree_size += delta;
+      if (node->parent == node) {
+        break;
+      }
+    }
+  }
 
   static void replace(base_node* old_son, base_node* new_son) {
     if (old_son->parent->left_son == old_son) {
@@ -130,6 +206,7 @@ private:
     parent = this;
     left_son = this;
     right_son = this;
+    subtree_size = 0;
   }
 
   static void link_r(base_node* rson, base_node* parent) {
@@ -141,6 +218,336 @@ private:
     parent->left_son = lson;
     lson->parent = parent;
   }
+
+  // Вставляет node в список непосредственно перед pos.
+  static void thread_before(base_node* node, base_node* pos) noexcept {
+    node->prev = pos->prev;
+    node->next = pos;
+    pos->prev->next = node;
+    pos->prev = node;
+  }
+
+  static void thread_after(base_node* node, base_node* pos) noexcept {
+    thread_before(node, pos->next);
+  }
+
+  // Переносит список головы from к голове to, чей список пуст.
+  static void move_thread(base_node* from, base_node* to) noexcept {
+    if (from->next == from) {
+      return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    from->next = from;
+    from->prev = from;
+  }
+
+  // Правый сын node встает на его место, node становится его левым сыном.
+  static void rotate_left(base_node* node) {
+    base_node* son = node->right_son;
+    if (son->has_left()) {
+      link_r(son->left_son, node);
+    } else {
+      node->right_son = node;
+    }
+    replace(node, son);
+    link_l(node, son);
+    son->subtree_size = node->subtree_size;
+    node->update_size();
+  }
+
+  static void rotate_right(base_node* node) {
+    base_node* son = node->left_son;
+    if (son->has_right()) {
+      link_l(son->right_son, node);
+    } else {
+      node->left_son = node;
+    }
+    replace(node, son);
+    link_r(node, son);
+    son->subtree_size = node->subtree_size;
+    node->update_size();
+  }
+
+  // Восстанавливает красно-черные свойства после того, как node был
+  // подвешен листом.
+  static void rebalance_after_insert(base_node* node) {
+    node->red = true;
+    while (node->parent->red) {
+      base_node* par = node->parent;
+      base_node* grand = par->parent;
+      if (grand->left_son == par) {
+        base_node* uncle = grand->right_son;
+        if (grand->has_right() && uncle->red) {
+          par->red = false;
+          uncle->red = false;
+          grand->red = true;
+          node = grand;
+        } else {
+          if (par->right_son == node) {
+            rotate_left(par);
+            node = par;
+            par = node->parent;
+          }
+          par->red = false;
+          grand->red = true;
+          rotate_right(grand);
+        }
+      } else {
+        base_node* uncle = grand->left_son;
+        if (grand->has_left() && uncle->red) {
+          par->red = false;
+          uncle->red = false;
+          grand->red = true;
+          node = grand;
+        } else {
+          if (par->left_son == node) {
+            rotate_right(par);
+            node = par;
+            par = node->parent;
+          }
+          par->red = false;
+          grand->red = true;
+          rotate_left(grand);
+        }
+      }
+    }
+    if (node->parent->parent == node->parent) {
+      node->red = false;
+    }
+  }
+
+  // Число черных вершин на пути от node до пустого сына.
+  static std::size_t black_height(base_node* node) noexcept {
+    std::size_t res = 0;
+    for (; node != nullptr; node = node->has_left() ? node->left_son : nullptr) {
+      res += !node->red;
+    }
+    return res;
+  }
+
+  // Переносит дерево, подвешенное к голове from, к пустой голове to.
+  static void move_tree(base_node* from, base_node* to) noexcept {
+    if (from->has_left()) {
+      link_l(from->left_son, to);
+    }
+    to->subtree_size = from->subtree_size;
+    from->left_son = from;
+    from->subtree_size = 0;
+  }
+
+  // Сливает деревья голов left_head и right_head, подвесив между ними
+  // отдельную вершину mid; все элементы left_head должны быть меньше mid,
+  // а mid -- меньше элементов right_head. Результат оказывается в left_head.
+  // mid встает на спуск по краю более высокого дерева туда, где черная высота
+  // совпадает с высотой другого, после чего чинится как вставленная вершина.
+  static void join(base_node* left_head, base_node* mid, base_node* right_head) noexcept {
+    base_node* lhs = left_head->has_left() ? left_head->left_son : nullptr;
+    base_node* rhs = right_head->has_left() ? right_head->left_son : nullptr;
+    std::size_t lhs_size = left_head->subtree_size;
+    std::size_t rhs_size = right_head->subtree_size;
+    if (lhs != nullptr) {
+      lhs->red = false;
+    }
+    if (rhs != nullptr) {
+      rhs->red = false;
+    }
+    std::size_t lhs_height = black_height(lhs);
+    std::size_t rhs_height = black_height(rhs);
+    mid->unlink();
+    base_node* par;
+    base_node* cur;
+    std::size_t height;
+    if (lhs_height >= rhs_height) {
+      for (par = left_head, cur = lhs, height = lhs_height; cur != nullptr && (cur->red || height > rhs_height);) {
+        height -= !cur->red;
+        par = cur;
+        cur = cur->has_right() ? cur->right_son : nullptr;
+      }
+      if (cur != nullptr) {
+        link_l(cur, mid);
+      }
+      if (rhs != nullptr) {
+        link_r(rhs, mid);
+      }
+      right_head->left_son = right_head;
+      right_head->subtree_size = 0;
+      if (par == left_head) {
+        link_l(mid, par);
+      } else {
+        link_r(mid, par);
+      }
+      add_path(par, rhs_size + 1);
+    } else {
+      for (par = right_head, cur = rhs, height = rhs_height; cur != nullptr && (cur->red || height > lhs_height);) {
+        height -= !cur->red;
+        par = cur;
+        cur = cur->has_left() ? cur->left_son : nullptr;
+      }
+      if (lhs != nullptr) {
+        link_l(lhs, mid);
+      }
+      if (cur != nullptr) {
+        link_r(cur, mid);
+      }
+      left_head->left_son = left_head;
+      left_head->subtree_size = 0;
+      link_l(mid, par);
+      add_path(par, lhs_size + 1);
+    }
+    mid->update_size();
+    rebalance_after_insert(mid);
+    if (lhs_height < rhs_height) {
+      move_tree(right_head, left_head);
+    }
+  }
+
+  // Сливает деревья голов left_head и right_head, используя минимум
+  // right_head как разделитель. Результат оказывается в left_head.
+  static void concat(base_node* left_head, base_node* right_head) noexcept {
+    if (!right_head->has_left()) {
+      return;
+    }
+    base_node* mid = get_most_left(right_head->left_son);
+    mid->detach();
+    join(left_head, mid, right_head);
+  }
+
+  // Разбивает дерево головы head на первые index элементов, которые
+  // подвешиваются к less_head, и остальные, которые подвешиваются к
+  // greater_head. head остается пустым, less_head и greater_head должны быть
+  // пусты. Работает за O(log^2 n).
+  static void split(base_node* head, std::size_t index, base_node* less_head, base_node* greater_head) noexcept {
+    if (!head->has_left()) {
+      return;
+    }
+    base_node* root = head->left_son;
+    base_node left_part;
+    base_node right_part;
+    if (root->has_left()) {
+      link_l(root->left_son, &left_part);
+      left_part.subtree_size = root->left_size();
+    }
+    if (root->has_right()) {
+      link_l(root->right_son, &right_part);
+      right_part.subtree_size = root->right_size();
+    }
+    head->left_son = head;
+    head->subtree_size = 0;
+    std::size_t left = left_part.subtree_size;
+    if (index <= left) {
+      split(&left_part, index, less_head, greater_head);
+      join(greater_head, root, &right_part);
+    } else {
+      split(&right_part, index - left - 1, less_head, greater_head);
+      join(&left_part, root, less_head);
+      move_tree(&left_part, less_head);
+    }
+  }
+
+  // Разбирает дерево головы head снизу вверх без перебалансировок: каждая
+  // вершина отцепляется и передается в dispose, когда ее сыновья уже
+  // разобраны. Работает за O(n).
+  template <typename F>
+  static void dismantle(base_node* head, F& dispose) noexcept {
+    if (!head->has_left()) {
+      return;
+    }
+    base_node* cur_node = head->left_son;
+    while (true) {
+      if (cur_node->has_left()) {
+        cur_node = cur_node->left_son;
+      } else if (cur_node->has_right()) {
+        cur_node = cur_node->right_son;
+      } else {
+        base_node* par = cur_node->parent;
+        cur_node->rem_from_parent();
+        cur_node->unlink();
+        cur_node->prev = cur_node;
+        cur_node->next = cur_node;
+        dispose(cur_node);
+        if (par == head) {
+          break;
+        }
+        cur_node = par;
+      }
+    }
+    head->subtree_size = 0;
+    head->prev = head;
+    head->next = head;
+  }
+
+  // Восстанавливает черную высоту после удаления черной вершины.
+  // node -- вершина, вставшая на место удаленной (nullptr, если ее нет),
+  // par -- ее родитель.
+  static void rebalance_after_erase(base_node* node, base_node* par) {
+    while (par->parent != par && (node == nullptr || !node->red)) {
+      if (par->left_son == (node == nullptr ? par : node)) {
+        base_node* brother = par->right_son;
+        if (brother->red) {
+          brother->red = false;
+          par->red = true;
+          rotate_left(par);
+          brother = par->right_son;
+        }
+        bool left_black = !brother->has_left() || !brother->left_son->red;
+        bool right_black = !brother->has_right() || !brother->right_son->red;
+        if (left_black && right_black) {
+          brother->red = true;
+          node = par;
+          par = par->parent;
+        } else {
+          if (right_black) {
+            brother->left_son->red = false;
+            brother->red = true;
+            rotate_right(brother);
+            brother = par->right_son;
+          }
+          brother->red = par->red;
+          par->red = false;
+          if (brother->has_right()) {
+            brother->right_son->red = false;
+          }
+          rotate_left(par);
+          return;
+        }
+      } else {
+        base_node* brother = par->left_son;
+        if (brother->red) {
+          brother->red = false;
+          par->red = true;
+          rotate_right(par);
+          brother = par->left_son;
+        }
+        bool left_black = !brother->has_left() || !brother->left_son->red;
+        bool right_black = !brother->has_right() || !brother->right_son->red;
+        if (left_black && right_black) {
+          brother->red = true;
+          node = par;
+          par = par->parent;
+        } else {
+          if (left_black) {
+            brother->right_son->red = false;
+            brother->red = true;
+            rotate_left(brother);
+            brother = par->left_son;
+          }
+          brother->red = par->red;
+          par->red = false;
+          if (brother->has_left()) {
+            brother->left_son->red = false;
+          }
+          rotate_right(par);
+          return;
+        }
+      }
+    }
+    if (node != nullptr) {
+      node->red = false;
+    }
+  }
 };
 
 template <typename Tag = default_tag>
@@ -161,16 +568,23 @@ private:
     equal
   };
 
-  compare_res compare_data(const Data_type& lhs, const Data_type& rhs) const {
-    if (comparator(lhs, rhs)) {
+  template <typename K, typename Probe = null_probe>
+  compare_res compare_data(const Data_type& lhs, const K& rhs, Probe&& probe = Probe()) const {
+    if (less(probe, lhs, rhs)) {
       return compare_res::less;
-    } else if (comparator(rhs, lhs)) {
+    } else if (less(probe, rhs, lhs)) {
       return compare_res::greater;
     } else {
       return compare_res::equal;
     }
   }
 
+  template <typename Probe, typename A, typename B>
+  bool less(Probe& probe, const A& lhs, const B& rhs) const {
+    probe.compare();
+    return comparator(lhs, rhs);
+  }
+
   template <class E>
   struct tree_iterator {
     using value_type = Node_type;
@@ -252,6 +666,11 @@ public:
 
   tree(tree_element<Tag>* head, Compare&& input_comp) noexcept : comparator(std::move(input_comp)), sentinel(head) {}
 
+  // Вершины дерева -- сами элементы, поэтому аллокатор не нужен. Перегрузка
+  // нужна, чтобы tree и btree создавались одинаково.
+  template <typename Allocator>
+  tree(tree_element<Tag>* head, Compare&& input_comp, const Allocator&) noexcept : tree(head, std::move(input_comp)) {}
+
   ~tree() {
     clear();
   }
@@ -263,7 +682,10 @@ public:
     if (!other.empty()) {
       base_node::link_l(other.sentinel->left_son, sentinel);
     }
+    sentinel->subtree_size = other.sentinel->subtree_size;
     other.sentinel->left_son = other.sentinel;
+    other.sentinel->subtree_size = 0;
+    base_node::move_thread(other.sentinel, sentinel);
   }
 
   tree& operator=(tree&& other) noexcept = default;
@@ -273,7 +695,7 @@ public:
   }
 
   size_t size() const noexcept {
-    return std::distance(begin(), end());
+    return sentinel->subtree_size;
   }
 
   void clear() noexcept {
@@ -281,13 +703,31 @@ public:
   }
 
   iterator begin() const noexcept {
-    return iterator(static_cast<base_node*>(static_cast<tree_element<Tag>*>(sentinel))->get_next());
+    return iterator(static_cast<base_node*>(sentinel)->get_next());
   }
 
   iterator end() const noexcept {
     return iterator(static_cast<base_node*>(sentinel));
   }
 
+  // Строит дерево за линейное время из вершин [first, last), уже
+  // упорядоченных по возрастанию ключей без повторов. Дерево должно быть пустым.
+  template <typename RandomIt>
+  void build_sorted(RandomIt first, RandomIt last) noexcept {
+    if (first == last) {
+      return;
+    }
+    // Поддеревья отличаются по размеру не больше чем на 1, поэтому все пустые
+    // сыновья лежат на глубине red_depth или red_depth + 1. Красим вершины
+    // на глубине red_depth, и черная высота всех путей совпадает.
+    std::size_t red_depth = std::bit_width(static_cast<std::size_t>(last - first) + 1) - 1;
+    base_node::link_l(build_subtree(first, last, 0, red_depth), sentinel);
+    sentinel->subtree_size = last - first;
+    for (; first != last; ++first) {
+      base_node::thread_before(static_cast<tree_element<Tag>*>(*first), sentinel);
+    }
+  }
+
   void swap(tree& other) {
     base_node* temp = sentinel->left_son;
     if (!other.empty()) {
@@ -300,38 +740,237 @@ public:
     } else {
       other.sentinel->left_son = other.sentinel;
     }
+    std::size_t temp_size = sentinel->subtree_size;
+    sentinel->subtree_size = other.sentinel->subtree_size;
+    other.sentinel->subtree_size = temp_size;
+    base_node temp_thread;
+    base_node::move_thread(sentinel, &temp_thread);
+    base_node::move_thread(other.sentinel, sentinel);
+    base_node::move_thread(&temp_thread, other.sentinel);
   }
 
-  iterator insert(Node_type* value) noexcept {
-    if (empty()) {
-      base_node::link_l(static_cast<tree_element<Tag>*>(value), sentinel);
-      return iterator(static_cast<tree_element<Tag>*>(value));
+  // Место для вставки нового элемента: вершина, к которой он будет подвешен,
+  // и сторона. Если равный элемент уже есть, occupied() == true, а get()
+  // указывает на него.
+  class insert_position {
+    friend tree;
+
+  public:
+    bool occupied() const noexcept {
+      return side == compare_res::equal;
     }
-    auto pos_to_ins = find_to_insert(Get::get(*value));
-    if (pos_to_ins.second == compare_res::equal) {
-      return end();
-    } else if (pos_to_ins.second == compare_res::less) {
-      base_node::link_l(static_cast<tree_element<Tag>*>(value), pos_to_ins.first._elem);
+
+    iterator get() const noexcept {
+      return where;
+    }
+
+  private:
+    insert_position(iterator where, compare_res side) : where(where), side(side) {}
+
+    iterator where;
+    compare_res side;
+  };
+
+  insert_position find_position(const Data_type& value) const {
+    auto probe = counters.start(operation::insert);
+    auto res = find_to_insert(value, probe);
+    return {res.first, res.second};
+  }
+
+  // Как find_position, но сначала проверяет, нельзя ли вставить value
+  // непосредственно перед hint. Если подсказка верна, делает O(1) сравнений.
+  insert_position find_position(iterator hint, const Data_type& value) const {
+    auto probe = counters.start(operation::insert);
+    auto search = [&] {
+      auto res = find_to_insert(value, probe);
+      return insert_position(res.first, res.second);
+    };
+    if (hint == end()) {
+      iterator last = std::prev(hint);
+      if (last != end() && less(probe, Get::get(*last), value)) {
+        return {last, compare_res::greater};
+      }
+      return search();
+    }
+    const Data_type& at_hint = Get::get(*hint);
+    if (less(probe, value, at_hint)) {
+      iterator before = std::prev(hint);
+      if (before == end()) {
+        return {hint, compare_res::less};
+      }
+      if (less(probe, Get::get(*before), value)) {
+        if (!before._elem->has_right()) {
+          return {before, compare_res::greater};
+        }
+        return {hint, compare_res::less};
+      }
+      return search();
+    }
+    if (less(probe, at_hint, value)) {
+      iterator after = std::next(hint);
+      if (after == end()) {
+        return {hint, compare_res::greater};
+      }
+      if (less(probe, value, Get::get(*after))) {
+        if (!hint._elem->has_right()) {
+          return {hint, compare_res::greater};
+        }
+        return {after, compare_res::less};
+      }
+      return search();
+    }
+    return {hint, compare_res::equal};
+  }
+
+  // Элемент, перед которым встанет значение, вставленное в pos, или end().
+  // Вынимание других элементов его не меняет, поэтому он годится подсказкой
+  // для find_position после таких изменений.
+  iterator successor(insert_position pos) const noexcept {
+    return pos.side == compare_res::greater ? std::next(pos.where) : pos.where;
+  }
+
+  iterator insert(Node_type* value) noexcept {
+    auto pos = find_position(Get::get(*value));
+    return pos.occupied() ? end() : insert(pos, value);
+  }
+
+  // Подвешивает value в место, найденное find_position для ключа value.
+  // Между поиском места и вставкой дерево не должно меняться.
+  iterator insert(insert_position pos, Node_type* value) noexcept {
+    base_node* node = static_cast<tree_element<Tag>*>(value);
+    if (pos.side == compare_res::less) {
+      base_node::link_l(node, pos.where._elem);
+      base_node::thread_before(node, pos.where._elem);
     } else {
-      base_node::link_r(static_cast<tree_element<Tag>*>(value), pos_to_ins.first._elem);
+      base_node::link_r(node, pos.where._elem);
+      base_node::thread_after(node, pos.where._elem);
     }
+    node->subtree_size = 1;
+    base_node::inc_path(node->parent);
+    base_node::rebalance_after_insert(node);
+    return iterator(node);
+  }
 
-    return iterator(static_cast<tree_element<Tag>*>(value));
+  // Методы поиска принимают любой ключ K, сравнимый с Data_type при помощи
+  // Compare. Проверять, что Compare прозрачный, должен вызывающий код.
+  template <typename K>
+  iterator lower_bound(const K& value) const {
+    auto probe = counters.start(operation::bound);
+    return get_bound([&](const Data_type& cur) { return !less(probe, cur, value); }, probe);
   }
 
-  iterator lower_bound(const Data_type& value) const {
-    return get_bound(value, [](compare_res inp) { return inp != compare_res::less; });
+  template <typename K>
+  iterator upper_bound(const K& value) const {
+    auto probe = counters.start(operation::bound);
+    return get_bound([&](const Data_type& cur) { return less(probe, value, cur); }, probe);
   }
 
-  iterator upper_bound(const Data_type& value) const {
-    return get_bound(value, [](compare_res inp) { return inp == compare_res::greater; });
+  // Элемент с номером index по порядку (с нуля) или end(), если index >= size().
+  iterator select(std::size_t index) const noexcept {
+    if (index >= size()) {
+      return end();
+    }
+    base_node* cur_node = sentinel->left_son;
+    while (true) {
+      std::size_t left = cur_node->left_size();
+      if (index < left) {
+        cur_node = cur_node->left_son;
+      } else if (index == left) {
+        return iterator(cur_node);
+      } else {
+        index -= left + 1;
+        cur_node = cur_node->right_son;
+      }
+    }
+  }
+
+  // Количество элементов, строго меньших value.
+  template <typename K>
+  std::size_t rank(const K& value) const {
+    auto probe = counters.start(operation::rank);
+    std::size_t res = 0;
+    base_node* cur_node = sentinel->left_son;
+    while (cur_node != sentinel) {
+      probe.step();
+      if (less(probe, Get::get(*iterator(cur_node)), value)) {
+        res += cur_node->left_size() + 1;
+        if (!cur_node->has_right()) {
+          break;
+        }
+        cur_node = cur_node->right_son;
+      } else {
+        if (!cur_node->has_left()) {
+          break;
+        }
+        cur_node = cur_node->left_son;
+      }
+    }
+    return res;
   }
 
-  iterator find(const Data_type& value) const {
-    auto res = find_to_insert(value);
+  // Номер элемента pos по порядку, size() для end().
+  std::size_t rank(iterator pos) const noexcept {
+    base_node* cur_node = pos._elem;
+    if (cur_node == sentinel) {
+      return size();
+    }
+    std::size_t res = cur_node->left_size();
+    for (; cur_node->parent != sentinel; cur_node = cur_node->parent) {
+      if (cur_node->parent->right_son == cur_node) {
+        res += cur_node->parent->left_size() + 1;
+      }
+    }
+    return res;
+  }
+
+  template <typename K>
+  iterator find(const K& value) const {
+    auto probe = counters.start(operation::find);
+    auto res = find_to_insert(value, probe);
     return (res.second == compare_res::equal) ? res.first : end();
   }
 
+  // Ищет keys[0], ..., keys[count - 1] и для каждого i вызывает
+  // report(i, iterator) с найденным элементом или end(). Спуски идут
+  // группами по batch_width: за проход каждый спуск группы делает один шаг и
+  // запрашивает следующую вершину, так что промахи кеша разных спусков
+  // перекрываются, а не идут друг за другом.
+  template <typename K, typename F>
+  void find_batch(const K* keys, std::size_t count, F&& report) const {
+    auto probe = counters.start(operation::find, count);
+    for (std::size_t first = 0; first < count; first += batch_width) {
+      std::size_t width = std::min(batch_width, count - first);
+      base_node* cur_nodes[batch_width];
+      std::size_t lanes[batch_width];
+      std::size_t active = empty() ? 0 : width;
+      for (std::size_t i = 0; i < width; i++) {
+        cur_nodes[i] = sentinel->left_son;
+        lanes[i] = i;
+      }
+      for (std::size_t i = active; i < width; i++) {
+        report(first + i, end());
+      }
+      while (active > 0) {
+        for (std::size_t j = 0; j < active;) {
+          std::size_t lane = lanes[j];
+          base_node* cur_node = cur_nodes[lane];
+          probe.step();
+          compare_res temp_comp = compare_data(Get::get(*iterator(cur_node)), keys[first + lane], probe);
+          base_node* next = temp_comp == compare_res::less ? cur_node->right_son : cur_node->left_son;
+          if (temp_comp == compare_res::equal || next == cur_node) {
+            report(first + lane, temp_comp == compare_res::equal ? iterator(cur_node) : end());
+            lanes[j] = lanes[--active];
+            continue;
+          }
+          prefetch(next);
+          prefetch(&Get::get(*iterator(next)));
+          cur_nodes[lane] = next;
+          j++;
+        }
+      }
+    }
+  }
+
   bool operator==(const tree& other) const {
     auto iter_r = other.begin();
     for (auto iter_l = begin(); iter_l != end(); iter_l++) {
@@ -353,22 +992,108 @@ public:
     return res;
   }
 
+  // Вынимает из дерева элементы [first, last), отрезая их двумя разрезами и
+  // сшивая остатки за O(log^2 n), после чего передает каждый отцепленный
+  // элемент в dispose(Node_type*). Возвращает количество вынутых элементов.
+  template <typename F>
+  std::size_t erase(iterator first, iterator last, F dispose) noexcept {
+    std::size_t first_rank = rank(first);
+    std::size_t last_rank = rank(last);
+    if (first_rank >= last_rank) {
+      return 0;
+    }
+    base_node* before = first._elem->prev;
+    before->next = last._elem;
+    last._elem->prev = before;
+    base_node less_head;
+    base_node middle_head;
+    base_node greater_head;
+    base_node::split(sentinel, first_rank, &less_head, &greater_head);
+    base_node::split(&greater_head, last_rank - first_rank, &middle_head, sentinel);
+    base_node::concat(&less_head, sentinel);
+    base_node::move_tree(&less_head, sentinel);
+    std::size_t res = middle_head.subtree_size;
+    auto unwrap = [&dispose](base_node* node) {
+      dispose(static_cast<Node_type*>(static_cast<tree_element<Tag>*>(node)));
+    };
+    base_node::dismantle(&middle_head, unwrap);
+    return res;
+  }
+
+  // Отцепляет все элементы за O(n) без перебалансировок и передает каждый в
+  // dispose(Node_type*).
+  template <typename F>
+  void clear(F dispose) noexcept {
+    auto unwrap = [&dispose](base_node* node) {
+      dispose(static_cast<Node_type*>(static_cast<tree_element<Tag>*>(node)));
+    };
+    base_node::dismantle(sentinel, unwrap);
+  }
+
   const Compare& get_comp() const {
     return comparator;
   }
 
+  // Форма дерева за O(n) и накопленные счетчики операций.
+  tree_stats stats() const noexcept {
+    tree_stats res;
+    res.size = size();
+    counters.fill(res);
+    if (empty()) {
+      return res;
+    }
+    // Обход в прямом порядке без стека: после листа поднимаемся до первой
+    // вершины, из левого поддерева которой пришли и у которой есть правый сын.
+    std::size_t total_depth = 0;
+    std::size_t depth = 1;
+    base_node* cur_node = sentinel->left_son;
+    while (true) {
+      total_depth += depth;
+      res.max_depth = std::max(res.max_depth, depth);
+      if (cur_node->has_left()) {
+        cur_node = cur_node->left_son;
+        depth++;
+        continue;
+      }
+      if (cur_node->has_right()) {
+        cur_node = cur_node->right_son;
+        depth++;
+        continue;
+      }
+      base_node* par = cur_node->parent;
+      while (par != sentinel && (par->right_son == cur_node || !par->has_right())) {
+        cur_node = par;
+        par = cur_node->parent;
+        depth--;
+      }
+      if (par == sentinel) {
+        break;
+      }
+      cur_node = par->right_son;
+    }
+    res.height = res.max_depth;
+    res.average_depth = static_cast<double>(total_depth) / static_cast<double>(res.size);
+    return res;
+  }
+
 private:
+  static constexpr std::size_t batch_width = 16;
+
   [[no_unique_address]] Compare comparator;
 
   tree_element<Tag>* sentinel;
 
-  std::pair<iterator, compare_res> find_to_insert(const Data_type& value) const {
+  [[no_unique_address]] operation_counters<> counters;
+
+  template <typename K, typename Probe>
+  std::pair<iterator, compare_res> find_to_insert(const K& value, Probe& probe) const {
     if (empty()) {
       return {end(), compare_res::less};
     }
     base_node* cur_node = sentinel->left_son;
     while (true) {
-      compare_res temp_comp = compare_data(Get::get(*iterator(cur_node)), value);
+      probe.step();
+      compare_res temp_comp = compare_data(Get::get(*iterator(cur_node)), value, probe);
       if (temp_comp == compare_res::less) {
         if (cur_node->right_son != cur_node) {
           cur_node = cur_node->right_son;
@@ -385,14 +1110,56 @@ private:
     }
   }
 
-  iterator get_bound(const Data_type& value, std::function<bool(compare_res)> end_condition) const {
-    for (auto iter = begin(); iter != end(); iter++) {
-      if (end_condition(compare_data(Get::get(*iter), value))) {
-        return iter;
+  template <typename RandomIt>
+  static base_node* build_subtree(RandomIt first, RandomIt last, std::size_t depth, std::size_t red_depth) noexcept {
+    RandomIt mid = first + (last - first) / 2;
+    Node_type* value = *mid;
+    base_node* node = static_cast<tree_element<Tag>*>(value);
+    node->unlink();
+    node->red = (depth == red_depth);
+    node->subtree_size = last - first;
+    if (first != mid) {
+      base_node::link_l(build_subtree(first, mid, depth + 1, red_depth), node);
+    }
+    if (mid + 1 != last) {
+      base_node::link_r(build_subtree(mid + 1, last, depth + 1, red_depth), node);
+    }
+    return node;
+  }
+
+  // Первый по порядку элемент, удовлетворяющий fits. fits должен быть
+  // монотонным: ложным на префиксе дерева и истинным на суффиксе.
+  template <typename Fits, typename Probe>
+  iterator get_bound(Fits fits, Probe& probe) const {
+    base_node* res = sentinel;
+    base_node* cur_node = sentinel->left_son;
+    while (cur_node != sentinel) {
+      probe.step();
+      if (fits(Get::get(*iterator(cur_node)))) {
+        res = cur_node;
+        if (!cur_node->has_left()) {
+          break;
+        }
+        cur_node = cur_node->left_son;
+      } else {
+        if (!cur_node->has_right()) {
+          break;
+        }
+        cur_node = cur_node->right_son;
       }
     }
-    return end();
+    return iterator(res);
   }
 };
 
+// Политика индекса bimap: обе стороны хранятся в красно-черных деревьях с
+// хуками в узлах.
+struct rb_tree_policy {
+  template <typename Tag>
+  using element = tree_element<Tag>;
+
+  template <typename Data_type, typename Node_type, typename Get, typename Tag, typename Compare, typename Allocator>
+  using tree_type = tree<Data_type, Node_type, Get, Tag, Compare>;
+};
+
 } // namespace intrusive
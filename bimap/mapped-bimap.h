@@ -0,0 +1,633 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Неизменяемый двусторонний словарь, читаемый из файла через mmap без
+// десериализации. Файл пишет mapped_bimap::write из bimap; открытие не
+// выделяет памяти на пары, страницы файла подгружаются по мере обращения и
+// разделяются всеми процессами, открывшими его.
+//
+// Формат: заголовок file_header, затем шесть секций, каждая с границы в
+// section_alignment байт:
+//   left_keys, right_keys -- ключи стороны по возрастанию. Ключ тривиально
+//     копируемого типа лежит как есть; у std::string -- size + 1 смещений
+//     (uint64) в секцию символов, ключ i -- символы [offsets[i], offsets[i + 1]);
+//   left_partner, right_partner -- index_t: позиция парного ключа на другой
+//     стороне;
+//   left_chars, right_chars -- символы строковых ключей подряд (у остальных
+//     типов пусты).
+// Числа хранятся в порядке байт машины, поэтому файл читается только там,
+// где совпадают порядок байт и размеры ключей; это проверяется при открытии
+// вместе с границами секций. Открытие также проходит все позиции парных
+// ключей и смещения строк (O(n), без выделения памяти), так что ни один
+// поиск или flip по принятому файлу не читает за пределами отображения.
+// Порядок ключей и взаимность позиций не проверяются: у испорченного в них
+// файла поиски дают неверные ответы, но не выходят за его пределы. Файл не
+// должен меняться на месте, пока отображен; write заменяет его целиком.
+//
+// Left и Right -- std::string или тривиально копируемые типы. Ключи
+// std::string видны как std::string_view. CompareLeft и CompareRight
+// вызываются для left_reference и right_reference и должны упорядочивать их
+// так же, как компараторы bimap, из которого записан файл.
+template <typename Left, typename Right, typename CompareLeft = std::less<>, typename CompareRight = std::less<>>
+class mapped_bimap {
+public:
+  using left_t = Left;
+  using right_t = Right;
+  using index_t = std::uint32_t;
+
+private:
+  struct left;
+  struct right;
+  template <typename>
+  class universal_iterator;
+
+  static constexpr std::size_t section_alignment = 64;
+  static constexpr std::uint32_t format_version = 1;
+  static constexpr std::uint32_t byte_order_mark = 0x01020304;
+  static constexpr char format_magic[8] = {'b', 'i', 'm', 'a', 'p', 'm', 'a', 'p'};
+
+  template <typename Key>
+  static constexpr bool is_string = std::is_same_v<Key, std::string>;
+
+  static_assert(is_string<Left> || (std::is_trivially_copyable_v<Left> && alignof(Left) <= section_alignment),
+                "Left must be std::string or trivially copyable");
+  static_assert(is_string<Right> || (std::is_trivially_copyable_v<Right> && alignof(Right) <= section_alignment),
+                "Right must be std::string or trivially copyable");
+
+  template <typename Tag>
+  struct side_traits {
+    static constexpr bool is_left = std::is_same_v<Tag, left>;
+
+    using key_type = std::conditional_t<is_left, Left, Right>;
+    using friend_tag = std::conditional_t<is_left, right, left>;
+    using value_type = std::conditional_t<is_string<key_type>, std::string_view, key_type>;
+    using reference = std::conditional_t<is_string<key_type>, std::string_view, const key_type&>;
+  };
+
+  enum section_id : std::size_t {
+    left_keys,
+    right_keys,
+    left_partner,
+    right_partner,
+    left_chars,
+    right_chars,
+    section_count
+  };
+
+  struct section {
+    std::uint64_t offset;
+    std::uint64_t length;
+  };
+
+  struct file_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    // sizeof ключа стороны, 0 для std::string.
+    std::uint32_t left_key_size;
+    std::uint32_t right_key_size;
+    std::uint64_t size;
+    section sections[section_count];
+  };
+
+  // Отображение файла в память только на чтение.
+  class mapping {
+  public:
+    mapping() = default;
+
+    explicit mapping(const std::string& path) {
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+      }
+      struct stat info;
+      if (::fstat(fd, &info) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "cannot stat " + path);
+      }
+      length = static_cast<std::size_t>(info.st_size);
+      if (length != 0) {
+        void* res = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        int error = errno;
+        ::close(fd);
+        if (res == MAP_FAILED) {
+          throw std::system_error(error, std::generic_category(), "cannot map " + path);
+        }
+        data = static_cast<const std::byte*>(res);
+      } else {
+        ::close(fd);
+      }
+    }
+
+    mapping(mapping&& other) noexcept
+        : data(std::exchange(other.data, nullptr)),
+          length(std::exchange(other.length, 0)) {}
+
+    mapping& operator=(mapping&& other) noexcept {
+      std::swap(data, other.data);
+      std::swap(length, other.length);
+      return *this;
+    }
+
+    ~mapping() {
+      if (data != nullptr) {
+        ::munmap(const_cast<std::byte*>(data), length);
+      }
+    }
+
+    const std::byte* data{nullptr};
+    std::size_t length{0};
+  };
+
+  // Указатели на секции одной стороны внутри отображения.
+  template <typename Tag>
+  struct side_data {
+    using traits = side_traits<Tag>;
+    using key_type = typename traits::key_type;
+
+    typename traits::reference key(std::size_t pos) const noexcept {
+      if constexpr (is_string<key_type>) {
+        const auto* offsets = reinterpret_cast<const std::uint64_t*>(keys);
+        return {chars + offsets[pos], static_cast<std::size_t>(offsets[pos + 1] - offsets[pos])};
+      } else {
+        return reinterpret_cast<const key_type*>(keys)[pos];
+      }
+    }
+
+    const std::byte* keys{nullptr};
+    const index_t* partner{nullptr};
+    const char* chars{nullptr};
+  };
+
+  template <typename Tag>
+  class universal_iterator {
+  private:
+    template <typename, typename, typename, typename>
+    friend class mapped_bimap;
+    template <typename>
+    friend class universal_iterator;
+
+    using traits = side_traits<Tag>;
+
+  public:
+    using value_type = typename traits::value_type;
+    using reference = typename traits::reference;
+    using pointer = const value_type*;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    universal_iterator() = default;
+
+    reference operator*() const {
+      return owner->template side<Tag>().key(pos);
+    }
+
+    // У строковых ключей нет объекта в памяти, на который можно указать.
+    pointer operator->() const
+      requires(!is_string<typename traits::key_type>)
+    {
+      return &**this;
+    }
+
+    universal_iterator& operator++() {
+      ++pos;
+      return *this;
+    }
+
+    universal_iterator operator++(int) {
+      universal_iterator temp = *this;
+      ++(*this);
+      return temp;
+    }
+
+    universal_iterator& operator--() {
+      --pos;
+      return *this;
+    }
+
+    universal_iterator operator--(int) {
+      universal_iterator temp = *this;
+      --(*this);
+      return temp;
+    }
+
+    universal_iterator<typename traits::friend_tag> flip() const {
+      if (pos == owner->size()) {
+        return {owner, pos};
+      }
+      return {owner, owner->template side<Tag>().partner[pos]};
+    }
+
+    friend bool operator==(const universal_iterator& lhs, const universal_iterator& rhs) {
+      return lhs.pos == rhs.pos && lhs.owner == rhs.owner;
+    }
+
+    friend bool operator!=(const universal_iterator& lhs, const universal_iterator& rhs) {
+      return !(lhs == rhs);
+    }
+
+  private:
+    universal_iterator(const mapped_bimap* owner, std::size_t pos) : owner(owner), pos(pos) {}
+
+    const mapped_bimap* owner{nullptr};
+    std::size_t pos{0};
+  };
+
+public:
+  using left_iterator = universal_iterator<left>;
+  using right_iterator = universal_iterator<right>;
+  using left_reference = typename side_traits<left>::reference;
+  using right_reference = typename side_traits<right>::reference;
+
+  // Пустой словарь, не связанный ни с каким файлом.
+  mapped_bimap(CompareLeft compare_left = CompareLeft(), CompareRight compare_right = CompareRight())
+      : comp_left(std::move(compare_left)),
+        comp_right(std::move(compare_right)) {}
+
+  // Отображает файл path, записанный write. Если файл не открывается,
+  // бросает std::system_error, если он не в формате mapped_bimap с теми же
+  // типами ключей -- std::runtime_error.
+  explicit mapped_bimap(const std::string& path, CompareLeft compare_left = CompareLeft(),
+                        CompareRight compare_right = CompareRight())
+      : comp_left(std::move(compare_left)),
+        comp_right(std::move(compare_right)),
+        file(path) {
+    file_header header;
+    if (file.length < sizeof(header)) {
+      throw std::runtime_error("not a mapped_bimap file: " + path);
+    }
+    std::memcpy(&header, file.data, sizeof(header));
+    if (std::memcmp(header.magic, format_magic, sizeof(format_magic)) != 0 || header.version != format_version ||
+        header.byte_order != byte_order_mark || header.left_key_size != key_size<Left>() ||
+        header.right_key_size != key_size<Right>() || header.size > std::numeric_limits<index_t>::max()) {
+      throw std::runtime_error("incompatible mapped_bimap file: " + path);
+    }
+    count = header.size;
+    if (!open_side(header, left_keys, left_partner, left_chars, left_side) ||
+        !open_side(header, right_keys, right_partner, right_chars, right_side)) {
+      throw std::runtime_error("corrupted mapped_bimap file: " + path);
+    }
+  }
+
+  mapped_bimap(mapped_bimap&& other) noexcept
+      : comp_left(std::move(other.comp_left)),
+        comp_right(std::move(other.comp_right)),
+        file(std::move(other.file)),
+        count(std::exchange(other.count, 0)),
+        left_side(std::exchange(other.left_side, {})),
+        right_side(std::exchange(other.right_side, {})) {}
+
+  mapped_bimap& operator=(mapped_bimap&& other) noexcept {
+    if (this != &other) {
+      mapped_bimap temp(std::move(other));
+      swap(*this, temp);
+    }
+    return *this;
+  }
+
+  mapped_bimap(const mapped_bimap&) = delete;
+  mapped_bimap& operator=(const mapped_bimap&) = delete;
+
+  // Записывает map в файл path в формате mapped_bimap. Файл сначала пишется
+  // рядом под уникальным временным именем и затем переименовывается, так что
+  // процессы, уже отобразившие старый path, его не увидят изменившимся, а
+  // одновременные write в один path не портят файлы друг друга: выигрывает
+  // последнее переименование. Ошибки записи бросаются как
+  // std::ios_base::failure, std::filesystem::filesystem_error или
+  // std::system_error.
+  // Перекрестные индексы считаются через rank_left и rank_right:
+  // O(n log n) времени и O(1) дополнительной памяти.
+  template <typename Map>
+  static void write(const Map& map, const std::string& path) {
+    static_assert(std::is_same_v<typename Map::left_t, Left> && std::is_same_v<typename Map::right_t, Right>,
+                  "key types of map must match mapped_bimap");
+    if (map.size() > std::numeric_limits<index_t>::max()) {
+      throw std::length_error("bimap is too large for mapped_bimap");
+    }
+    file_header header{};
+    std::memcpy(header.magic, format_magic, sizeof(format_magic));
+    header.version = format_version;
+    header.byte_order = byte_order_mark;
+    header.left_key_size = key_size<Left>();
+    header.right_key_size = key_size<Right>();
+    header.size = map.size();
+    std::uint64_t offset = sizeof(header);
+    auto place = [&offset, &header](section_id id, std::uint64_t length) {
+      offset = align(offset);
+      header.sections[id] = {offset, length};
+      offset += length;
+    };
+    place(left_keys, keys_length<Left>(map.size()));
+    place(right_keys, keys_length<Right>(map.size()));
+    place(left_partner, map.size() * sizeof(index_t));
+    place(right_partner, map.size() * sizeof(index_t));
+    place(left_chars, chars_length<Left>(map.begin_left(), map.end_left()));
+    place(right_chars, chars_length<Right>(map.begin_right(), map.end_right()));
+
+    std::string temp_path = create_temp(path);
+    try {
+      std::ofstream out;
+      out.exceptions(std::ios::failbit | std::ios::badbit);
+      out.open(temp_path, std::ios::binary | std::ios::trunc);
+      write_value(out, header);
+      pad(out, header.sections[left_keys].offset);
+      write_keys<Left>(out, map.begin_left(), map.end_left());
+      pad(out, header.sections[right_keys].offset);
+      write_keys<Right>(out, map.begin_right(), map.end_right());
+      pad(out, header.sections[left_partner].offset);
+      for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+        write_value(out, static_cast<index_t>(map.rank_right(*it.flip())));
+      }
+      pad(out, header.sections[right_partner].offset);
+      for (auto it = map.begin_right(); it != map.end_right(); ++it) {
+        write_value(out, static_cast<index_t>(map.rank_left(*it.flip())));
+      }
+      pad(out, header.sections[left_chars].offset);
+      write_chars<Left>(out, map.begin_left(), map.end_left());
+      pad(out, header.sections[right_chars].offset);
+      write_chars<Right>(out, map.begin_right(), map.end_right());
+      out.close();
+      std::filesystem::rename(temp_path, path);
+    } catch (...) {
+      std::error_code ignored;
+      std::filesystem::remove(temp_path, ignored);
+      throw;
+    }
+  }
+
+  // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  left_iterator find_left(left_reference left) const {
+    std::size_t pos = lower_bound(left_side, left, comp_left);
+    return {this, (pos != size() && !comp_left(left, left_side.key(pos))) ? pos : size()};
+  }
+
+  right_iterator find_right(right_reference right) const {
+    std::size_t pos = lower_bound(right_side, right, comp_right);
+    return {this, (pos != size() && !comp_right(right, right_side.key(pos))) ? pos : size()};
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  right_reference at_left(left_reference key) const {
+    auto it = find_left(key);
+    if (it.pos == size()) {
+      throw std::out_of_range("key not found");
+    }
+    return *it.flip();
+  }
+
+  left_reference at_right(right_reference key) const {
+    auto it = find_right(key);
+    if (it.pos == size()) {
+      throw std::out_of_range("key not found");
+    }
+    return *it.flip();
+  }
+
+  // lower и upper bound'ы по каждой стороне
+  left_iterator lower_bound_left(left_reference left) const {
+    return {this, lower_bound(left_side, left, comp_left)};
+  }
+
+  left_iterator upper_bound_left(left_reference left) const {
+    return {this, upper_bound(left_side, left, comp_left)};
+  }
+
+  right_iterator lower_bound_right(right_reference right) const {
+    return {this, lower_bound(right_side, right, comp_right)};
+  }
+
+  right_iterator upper_bound_right(right_reference right) const {
+    return {this, upper_bound(right_side, right, comp_right)};
+  }
+
+  left_iterator begin_left() const {
+    return {this, 0};
+  }
+
+  left_iterator end_left() const {
+    return {this, size()};
+  }
+
+  right_iterator begin_right() const {
+    return {this, 0};
+  }
+
+  right_iterator end_right() const {
+    return {this, size()};
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+
+  friend void swap(mapped_bimap& lhs, mapped_bimap& rhs) noexcept {
+    using std::swap;
+    swap(lhs.comp_left, rhs.comp_left);
+    swap(lhs.comp_right, rhs.comp_right);
+    swap(lhs.file, rhs.file);
+    swap(lhs.count, rhs.count);
+    swap(lhs.left_side, rhs.left_side);
+    swap(lhs.right_side, rhs.right_side);
+  }
+
+private:
+  template <typename Tag>
+  const side_data<Tag>& side() const noexcept {
+    if constexpr (std::is_same_v<Tag, left>) {
+      return left_side;
+    } else {
+      return right_side;
+    }
+  }
+
+  // Создает рядом с path пустой файл с именем, которого еще нет, и
+  // возвращает это имя. В имени pid и счетчик вызовов, а O_EXCL отсекает
+  // остатки от завершившихся процессов с тем же pid. Права -- как у файла,
+  // созданного std::ofstream.
+  static std::string create_temp(const std::string& path) {
+    static std::atomic<std::uint64_t> counter{0};
+    while (true) {
+      std::string res = path + ".tmp." + std::to_string(::getpid()) + "." +
+                        std::to_string(counter.fetch_add(1, std::memory_order_relaxed));
+      int fd = ::open(res.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+      if (fd >= 0) {
+        ::close(fd);
+        return res;
+      }
+      if (errno != EEXIST) {
+        throw std::system_error(errno, std::generic_category(), "cannot create " + res);
+      }
+    }
+  }
+
+  template <typename Key>
+  static constexpr std::uint32_t key_size() noexcept {
+    return is_string<Key> ? 0 : sizeof(Key);
+  }
+
+  template <typename Key>
+  static constexpr std::uint64_t keys_length(std::uint64_t size) noexcept {
+    return is_string<Key> ? (size + 1) * sizeof(std::uint64_t) : size * sizeof(Key);
+  }
+
+  static constexpr std::uint64_t align(std::uint64_t offset) noexcept {
+    return (offset + section_alignment - 1) / section_alignment * section_alignment;
+  }
+
+  // Проверяет, что секции стороны лежат внутри файла, их длины согласованы
+  // с заголовком, позиции парных ключей меньше count, а смещения строк не
+  // убывают и не выходят за секцию символов, и заполняет res.
+  template <typename Tag>
+  bool open_side(const file_header& header, section_id keys_id, section_id partner_id, section_id chars_id,
+                 side_data<Tag>& res) const noexcept {
+    using key_type = typename side_traits<Tag>::key_type;
+    const section& keys = header.sections[keys_id];
+    const section& partner = header.sections[partner_id];
+    const section& chars = header.sections[chars_id];
+    if (!fits(keys) || !fits(partner) || !fits(chars) || keys.length != keys_length<key_type>(count) ||
+        partner.length != count * sizeof(index_t)) {
+      return false;
+    }
+    res.keys = file.data + keys.offset;
+    res.partner = reinterpret_cast<const index_t*>(file.data + partner.offset);
+    res.chars = reinterpret_cast<const char*>(file.data + chars.offset);
+    for (std::size_t i = 0; i < count; i++) {
+      if (res.partner[i] >= count) {
+        return false;
+      }
+    }
+    if constexpr (is_string<key_type>) {
+      const auto* offsets = reinterpret_cast<const std::uint64_t*>(res.keys);
+      if (offsets[0] != 0 || offsets[count] != chars.length) {
+        return false;
+      }
+      for (std::size_t i = 0; i < count; i++) {
+        if (offsets[i] > offsets[i + 1]) {
+          return false;
+        }
+      }
+      return true;
+    } else {
+      return chars.length == 0;
+    }
+  }
+
+  bool fits(const section& sec) const noexcept {
+    return sec.offset % section_alignment == 0 && sec.offset <= file.length && sec.length <= file.length - sec.offset;
+  }
+
+  // Двоичный поиск, в котором выбор половины -- условное присваивание,
+  // а не переход, и число итераций зависит только от размера.
+  template <typename Tag, typename K, typename Compare>
+  std::size_t lower_bound(const side_data<Tag>& keys, const K& key, const Compare& comp) const {
+    if (empty()) {
+      return 0;
+    }
+    std::size_t base = 0;
+    std::size_t len = size();
+    while (len > 1) {
+      std::size_t half = len / 2;
+      base = comp(keys.key(base + half - 1), key) ? base + half : base;
+      len -= half;
+    }
+    return base + comp(keys.key(base), key);
+  }
+
+  template <typename Tag, typename K, typename Compare>
+  std::size_t upper_bound(const side_data<Tag>& keys, const K& key, const Compare& comp) const {
+    if (empty()) {
+      return 0;
+    }
+    std::size_t base = 0;
+    std::size_t len = size();
+    while (len > 1) {
+      std::size_t half = len / 2;
+      base = !comp(key, keys.key(base + half - 1)) ? base + half : base;
+      len -= half;
+    }
+    return base + !comp(key, keys.key(base));
+  }
+
+  template <typename Key, typename It>
+  static std::uint64_t chars_length(It first, It last) {
+    std::uint64_t res = 0;
+    if constexpr (is_string<Key>) {
+      for (; first != last; ++first) {
+        res += (*first).size();
+      }
+    }
+    return res;
+  }
+
+  template <typename T>
+  static void write_value(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  static void pad(std::ostream& out, std::uint64_t offset) {
+    for (auto pos = static_cast<std::uint64_t>(out.tellp()); pos < offset; pos++) {
+      out.put('\0');
+    }
+  }
+
+  template <typename Key, typename It>
+  static void write_keys(std::ostream& out, It first, It last) {
+    if constexpr (is_string<Key>) {
+      std::uint64_t offset = 0;
+      write_value(out, offset);
+      for (; first != last; ++first) {
+        offset += (*first).size();
+        write_value(out, offset);
+      }
+    } else {
+      for (; first != last; ++first) {
+        write_value(out, *first);
+      }
+    }
+  }
+
+  template <typename Key, typename It>
+  static void write_chars(std::ostream& out, It first, It last) {
+    if constexpr (is_string<Key>) {
+      for (; first != last; ++first) {
+        out.write((*first).data(), static_cast<std::streamsize>((*first).size()));
+      }
+    }
+  }
+
+  [[no_unique_address]] CompareLeft comp_left;
+  [[no_unique_address]] CompareRight comp_right;
+  mapping file;
+  std::size_t count{0};
+  side_data<left> left_side;
+  side_data<right> right_side;
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace detail {
+// Набор пулов, общий для pool_allocator<T, ChunkSize> с любыми T. Пулы
+// различаются размером и выравниванием слота, так что аллокаторы для типов
+// с одинаковой раскладкой делят один пул. Одиночные объекты выдаются из
+// непрерывных кусков по ChunkSize слотов, освобожденные слоты
+// переиспользуются через список свободных.
+template <std::size_t ChunkSize>
+class pool_set {
+  struct free_slot {
+    free_slot* next;
+  };
+
+  class pool {
+  public:
+    pool(std::size_t size, std::size_t align) noexcept : size(size), align(align) {}
+
+    pool(const pool&) = delete;
+    pool& operator=(const pool&) = delete;
+
+    ~pool() {
+      for (std::byte* chunk : chunks) {
+        ::operator delete(chunk, std::align_val_t(align));
+      }
+    }
+
+    bool fits(std::size_t slot_size, std::size_t slot_align) const noexcept {
+      return size == slot_size && align == slot_align;
+    }
+
+    void* allocate() {
+      if (free_list != nullptr) {
+        free_slot* res = free_list;
+        free_list = res->next;
+        return res;
+      }
+      if (used_in_last == ChunkSize) {
+        chunks.reserve(chunks.size() + 1);
+        chunks.push_back(static_cast<std::byte*>(::operator new(size * ChunkSize, std::align_val_t(align))));
+        used_in_last = 0;
+      }
+      return chunks.back() + size * used_in_last++;
+    }
+
+    void deallocate(void* ptr) noexcept {
+      free_slot* freed = new (ptr) free_slot{free_list};
+      free_list = freed;
+    }
+
+  private:
+    std::size_t size;
+    std::size_t align;
+    std::vector<std::byte*> chunks;
+    std::size_t used_in_last{ChunkSize};
+    free_slot* free_list{nullptr};
+  };
+
+public:
+  // Слот вмещает T и указатель списка свободных.
+  template <typename T>
+  static constexpr std::size_t slot_align = std::max(alignof(T), alignof(free_slot));
+
+  template <typename T>
+  static constexpr std::size_t slot_size =
+      (std::max(sizeof(T), sizeof(free_slot)) + slot_align<T> - 1) / slot_align<T> * slot_align<T>;
+
+  template <typename T>
+  T* allocate() {
+    pool* res = find(slot_size<T>, slot_align<T>);
+    if (res == nullptr) {
+      pools.reserve(pools.size() + 1);
+      pools.push_back(std::make_unique<pool>(slot_size<T>, slot_align<T>));
+      res = pools.back().get();
+    }
+    return static_cast<T*>(res->allocate());
+  }
+
+  // ptr выделен allocate<T> этого же набора, так что пул для T есть.
+  template <typename T>
+  void deallocate(T* ptr) noexcept {
+    find(slot_size<T>, slot_align<T>)->deallocate(ptr);
+  }
+
+private:
+  // Разных раскладок у контейнера единицы, поэтому поиск линейный.
+  pool* find(std::size_t size, std::size_t align) const noexcept {
+    for (const std::unique_ptr<pool>& cur : pools) {
+      if (cur->fits(size, align)) {
+        return cur.get();
+      }
+    }
+    return nullptr;
+  }
+
+  std::vector<std::unique_ptr<pool>> pools;
+};
+} // namespace detail
+
+// Аллокатор для узлов bimap поверх detail::pool_set. Куски отдаются системе
+// все разом, когда уничтожается последняя копия аллокатора, разделяющая
+// набор пулов.
+// Копии аллокатора и аллокаторы, полученные rebind и преобразованием,
+// разделяют один набор пулов и равны между собой, так что A(B(a)) == a.
+// Копия для нового контейнера (select_on_container_copy_construction)
+// получает собственный пустой набор. Пулы не потокобезопасны.
+// Запросы больше чем на один объект передаются std::allocator.
+template <typename T, std::size_t ChunkSize = 256>
+class pool_allocator {
+  static_assert(ChunkSize > 0, "ChunkSize must be positive");
+
+  template <typename, std::size_t>
+  friend class pool_allocator;
+
+  using pools = detail::pool_set<ChunkSize>;
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  template <typename U>
+  struct rebind {
+    using other = pool_allocator<U, ChunkSize>;
+  };
+
+  pool_allocator() : state(std::make_shared<pools>()) {}
+
+  template <typename U>
+  pool_allocator(const pool_allocator<U, ChunkSize>& other) noexcept : state(other.state) {}
+
+  pool_allocator select_on_container_copy_construction() const {
+    return pool_allocator();
+  }
+
+  T* allocate(std::size_t n) {
+    if (n != 1) {
+      return std::allocator<T>().allocate(n);
+    }
+    if (!state) {
+      state = std::make_shared<pools>();
+    }
+    return state->template allocate<T>();
+  }
+
+  // state пуст только у аллокатора, из которого переместили набор вместе
+  // с контейнером (propagate_on_container_move_assignment). Освобождать ему
+  // нечего: память, выделенная до перемещения, ушла с набором, а после
+  // перемещения allocate заводит новый набор.
+  void deallocate(T* ptr, std::size_t n) noexcept {
+    if (n != 1) {
+      std::allocator<T>().deallocate(ptr, n);
+      return;
+    }
+    state->deallocate(ptr);
+  }
+
+  template <typename U>
+  friend bool operator==(const pool_allocator& lhs, const pool_allocator<U, ChunkSize>& rhs) noexcept {
+    return lhs.shares_pools(rhs);
+  }
+
+  template <typename U>
+  friend bool operator!=(const pool_allocator& lhs, const pool_allocator<U, ChunkSize>& rhs) noexcept {
+    return !(lhs == rhs);
+  }
+
+private:
+  template <typename U>
+  bool shares_pools(const pool_allocator<U, ChunkSize>& other) const noexcept {
+    return state == other.state;
+  }
+
+  std::shared_ptr<pools> state;
+};
@@ -0,0 +1,622 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Двусторонний словарь без порядка на ключах. Как и в bimap, пара хранится
+// в одном узле, общем для обеих сторон, но каждая сторона индексируется
+// хеш-таблицей с открытой адресацией (линейное пробирование) вместо дерева,
+// поэтому поиск по любой стороне работает за ожидаемое O(1).
+// Вставка, которой требуется расширение таблицы, и копирование инвалидируют
+// все итераторы; удаление инвалидирует только итераторы на удаленную пару.
+template <typename Left, typename Right, typename HashLeft = std::hash<Left>, typename HashRight = std::hash<Right>,
+          typename EqualLeft = std::equal_to<Left>, typename EqualRight = std::equal_to<Right>,
+          typename Allocator = std::allocator<std::pair<Left, Right>>>
+class unordered_bimap {
+public:
+  using left_t = Left;
+  using right_t = Right;
+
+private:
+  struct left;
+  struct right;
+  template <typename>
+  class universal_iterator;
+
+  static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+  struct data_node {
+    template <typename L, typename R>
+    data_node(L&& left_key, R&& right_key) : left_key(std::forward<L>(left_key)), right_key(std::forward<R>(right_key)) {}
+
+    Left left_key;
+    Right right_key;
+    // Номера ячеек, в которых лежит узел в таблицах каждой из сторон.
+    std::size_t left_pos{0};
+    std::size_t right_pos{0};
+  };
+
+  template <typename Tag>
+  struct side_traits {
+    static constexpr bool is_left = std::is_same_v<Tag, left>;
+
+    using key_type = std::conditional_t<is_left, Left, Right>;
+    using hasher = std::conditional_t<is_left, HashLeft, HashRight>;
+    using key_equal = std::conditional_t<is_left, EqualLeft, EqualRight>;
+    using friend_tag = std::conditional_t<is_left, right, left>;
+
+    static const key_type& key(const data_node* node) noexcept {
+      if constexpr (is_left) {
+        return node->left_key;
+      } else {
+        return node->right_key;
+      }
+    }
+
+    static std::size_t& pos(data_node* node) noexcept {
+      if constexpr (is_left) {
+        return node->left_pos;
+      } else {
+        return node->right_pos;
+      }
+    }
+  };
+
+  // Таблица одной стороны. В ячейке хранится полный хеш ключа, поэтому при
+  // пробировании узел разыменовывается только при совпадении хешей, а при
+  // расширении хеши не пересчитываются. Удаленные ячейки помечаются и
+  // вычищаются при следующем перехешировании.
+  template <typename Tag>
+  class hash_index {
+    using traits = side_traits<Tag>;
+
+  public:
+    struct slot {
+      std::size_t hash;
+      data_node* node;
+    };
+
+    hash_index(typename traits::hasher hash_fn, typename traits::key_equal equal_fn, const Allocator& alloc)
+        : slots(slot_allocator(alloc)),
+          hash_fn(std::move(hash_fn)),
+          equal_fn(std::move(equal_fn)) {}
+
+    std::size_t capacity() const noexcept {
+      return slots.size();
+    }
+
+    data_node* node_at(std::size_t pos) const noexcept {
+      return slots[pos].node;
+    }
+
+    template <typename K>
+    std::size_t hash_of(const K& key) const {
+      return hash_fn(key);
+    }
+
+    template <typename K>
+    std::size_t find(const K& key, std::size_t hash) const {
+      if (slots.empty()) {
+        return npos;
+      }
+      for (std::size_t pos = home(hash);; pos = (pos + 1) & (capacity() - 1)) {
+        const slot& cur = slots[pos];
+        if (is_empty(cur)) {
+          return npos;
+        }
+        if (cur.node != nullptr && cur.hash == hash && equal_fn(traits::key(cur.node), key)) {
+          return pos;
+        }
+      }
+    }
+
+    // Следующая за from занятая ячейка или capacity().
+    std::size_t next_occupied(std::size_t from) const noexcept {
+      while (from < capacity() && slots[from].node == nullptr) {
+        ++from;
+      }
+      return from;
+    }
+
+    // Гарантирует, что после вставки еще одного элемента таблица останется
+    // заполненной не больше чем на max_load.
+    void reserve_one() {
+      if ((used + deleted + 1) * max_load_den > capacity() * max_load_num) {
+        rehash(std::max(min_capacity, std::bit_ceil((used + 1) * max_load_den / max_load_num + 1)));
+      }
+    }
+
+    void reserve(std::size_t count) {
+      if (count * max_load_den > capacity() * max_load_num) {
+        rehash(std::max(min_capacity, std::bit_ceil(count * max_load_den / max_load_num + 1)));
+      }
+    }
+
+    // Кладет node в таблицу. Ключа node в ней быть не должно, а место должно
+    // быть заранее обеспечено reserve_one.
+    void place(data_node* node, std::size_t hash) noexcept {
+      std::size_t pos = home(hash);
+      while (slots[pos].node != nullptr) {
+        pos = (pos + 1) & (capacity() - 1);
+      }
+      if (slots[pos].hash == deleted_mark) {
+        deleted--;
+      }
+      slots[pos] = {hash, node};
+      traits::pos(node) = pos;
+      used++;
+    }
+
+    void erase(std::size_t pos) noexcept {
+      // Если следующая ячейка пуста, ни одна цепочка пробирования не
+      // проходит через pos дальше, и метка удаления не нужна.
+      if (is_empty(slots[(pos + 1) & (capacity() - 1)])) {
+        slots[pos] = {empty_mark, nullptr};
+      } else {
+        slots[pos] = {deleted_mark, nullptr};
+        deleted++;
+      }
+      used--;
+    }
+
+    // Копирует расположение ячеек other, подставляя вместо его узлов копии
+    // из map_node.
+    template <typename MapNode>
+    void copy_layout(const hash_index& other, MapNode map_node) {
+      slots.assign(other.capacity(), slot{empty_mark, nullptr});
+      for (std::size_t pos = 0; pos < other.capacity(); pos++) {
+        const slot& cur = other.slots[pos];
+        slots[pos] = {cur.hash, cur.node == nullptr ? nullptr : map_node(cur.node)};
+      }
+      used = other.used;
+      deleted = other.deleted;
+    }
+
+    void clear() noexcept {
+      slots.clear();
+      used = 0;
+      deleted = 0;
+    }
+
+    void swap(hash_index& other) noexcept {
+      using std::swap;
+      slots.swap(other.slots);
+      swap(used, other.used);
+      swap(deleted, other.deleted);
+      swap(hash_fn, other.hash_fn);
+      swap(equal_fn, other.equal_fn);
+    }
+
+    const typename traits::hasher& get_hash() const noexcept {
+      return hash_fn;
+    }
+
+    const typename traits::key_equal& get_equal() const noexcept {
+      return equal_fn;
+    }
+
+  private:
+    using slot_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<slot>;
+
+    static constexpr std::size_t empty_mark = 0;
+    static constexpr std::size_t deleted_mark = 1;
+    static constexpr std::size_t min_capacity = 8;
+    static constexpr std::size_t max_load_num = 3;
+    static constexpr std::size_t max_load_den = 4;
+
+    // Фибоначчиево хеширование: берем старшие биты произведения, чтобы плохо
+    // перемешивающие хеши (например, std::hash<int>) не давали длинных цепочек.
+    std::size_t home(std::size_t hash) const noexcept {
+      constexpr std::size_t multiplier = static_cast<std::size_t>(0x9E3779B97F4A7C15ull);
+      return (hash * multiplier) >> (std::numeric_limits<std::size_t>::digits - std::countr_zero(capacity()));
+    }
+
+    static bool is_empty(const slot& cur) noexcept {
+      return cur.node == nullptr && cur.hash == empty_mark;
+    }
+
+    void rehash(std::size_t new_capacity) {
+      std::vector<slot, slot_allocator> old(new_capacity, slot{empty_mark, nullptr}, slots.get_allocator());
+      old.swap(slots);
+      used = 0;
+      deleted = 0;
+      for (const slot& cur : old) {
+        if (cur.node != nullptr) {
+          place(cur.node, cur.hash);
+        }
+      }
+    }
+
+    std::vector<slot, slot_allocator> slots;
+    std::size_t used{0};
+    std::size_t deleted{0};
+    [[no_unique_address]] typename traits::hasher hash_fn;
+    [[no_unique_address]] typename traits::key_equal equal_fn;
+  };
+
+  template <typename Tag>
+  class universal_iterator {
+  private:
+    template <typename, typename, typename, typename, typename, typename, typename>
+    friend class unordered_bimap;
+    template <typename>
+    friend class universal_iterator;
+
+    using traits = side_traits<Tag>;
+
+  public:
+    using value_type = typename traits::key_type;
+    using reference = const value_type&;
+    using pointer = const value_type*;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::forward_iterator_tag;
+
+    universal_iterator() = default;
+
+    const value_type& operator*() const {
+      return traits::key(owner->template index<Tag>().node_at(pos));
+    }
+
+    const value_type* operator->() const {
+      return &**this;
+    }
+
+    universal_iterator& operator++() {
+      pos = owner->template index<Tag>().next_occupied(pos + 1);
+      return *this;
+    }
+
+    universal_iterator operator++(int) {
+      universal_iterator temp = *this;
+      ++(*this);
+      return temp;
+    }
+
+    universal_iterator<typename traits::friend_tag> flip() const {
+      const auto& idx = owner->template index<Tag>();
+      if (pos == idx.capacity()) {
+        return {owner, owner->template index<typename traits::friend_tag>().capacity()};
+      }
+      return {owner, side_traits<typename traits::friend_tag>::pos(idx.node_at(pos))};
+    }
+
+    friend bool operator==(const universal_iterator& lhs, const universal_iterator& rhs) {
+      return lhs.pos == rhs.pos && lhs.owner == rhs.owner;
+    }
+
+    friend bool operator!=(const universal_iterator& lhs, const universal_iterator& rhs) {
+      return !(lhs == rhs);
+    }
+
+  private:
+    universal_iterator(const unordered_bimap* owner, std::size_t pos) : owner(owner), pos(pos) {}
+
+    bool is_end() const noexcept {
+      return pos == owner->template index<Tag>().capacity();
+    }
+
+    data_node* node() const noexcept {
+      return owner->template index<Tag>().node_at(pos);
+    }
+
+    const unordered_bimap* owner{nullptr};
+    std::size_t pos{0};
+  };
+
+public:
+  using allocator_type = Allocator;
+  using left_iterator = universal_iterator<left>;
+  using right_iterator = universal_iterator<right>;
+
+  // Создает unordered_bimap, не содержащий ни одной пары.
+  unordered_bimap(HashLeft hash_left = HashLeft(), HashRight hash_right = HashRight(),
+                  EqualLeft equal_left = EqualLeft(), EqualRight equal_right = EqualRight(),
+                  const Allocator& allocator = Allocator())
+      : alloc(allocator),
+        left_index(std::move(hash_left), std::move(equal_left), allocator),
+        right_index(std::move(hash_right), std::move(equal_right), allocator) {}
+
+  // Копия повторяет расположение ячеек other, поэтому хеши не пересчитываются
+  // и ключи не сравниваются.
+  unordered_bimap(const unordered_bimap& other)
+      : alloc(node_alloc_traits::select_on_container_copy_construction(other.alloc)),
+        left_index(other.left_index.get_hash(), other.left_index.get_equal(), Allocator(alloc)),
+        right_index(other.right_index.get_hash(), other.right_index.get_equal(), Allocator(alloc)) {
+    std::vector<data_node*> copies(other.left_index.capacity(), nullptr);
+    try {
+      for (std::size_t pos = 0; pos < other.left_index.capacity(); pos++) {
+        if (data_node* node = other.left_index.node_at(pos)) {
+          copies[pos] = create_node(node->left_key, node->right_key);
+          copies[pos]->left_pos = node->left_pos;
+          copies[pos]->right_pos = node->right_pos;
+        }
+      }
+      left_index.copy_layout(other.left_index, [&](data_node* node) { return copies[node->left_pos]; });
+      right_index.copy_layout(other.right_index, [&](data_node* node) { return copies[node->left_pos]; });
+    } catch (...) {
+      for (data_node* node : copies) {
+        if (node != nullptr) {
+          destroy_node(node);
+        }
+      }
+      left_index.clear();
+      right_index.clear();
+      throw;
+    }
+    elements_num = other.elements_num;
+  }
+
+  unordered_bimap(unordered_bimap&& other) noexcept
+      : elements_num(other.elements_num),
+        alloc(std::move(other.alloc)),
+        left_index(std::move(other.left_index)),
+        right_index(std::move(other.right_index)) {
+    other.left_index.clear();
+    other.right_index.clear();
+    other.elements_num = 0;
+  }
+
+  unordered_bimap& operator=(const unordered_bimap& other) {
+    if (this != &other) {
+      auto temp(other);
+      swap(*this, temp);
+    }
+    return *this;
+  }
+
+  unordered_bimap& operator=(unordered_bimap&& other) noexcept {
+    swap(other, *this);
+    return *this;
+  }
+
+  ~unordered_bimap() {
+    for (std::size_t pos = 0; pos < left_index.capacity(); pos++) {
+      if (data_node* node = left_index.node_at(pos)) {
+        destroy_node(node);
+      }
+    }
+  }
+
+  friend void swap(unordered_bimap& lhs, unordered_bimap& rhs) noexcept {
+    std::swap(lhs.elements_num, rhs.elements_num);
+    if constexpr (node_alloc_traits::propagate_on_container_swap::value) {
+      std::swap(lhs.alloc, rhs.alloc);
+    }
+    lhs.left_index.swap(rhs.left_index);
+    lhs.right_index.swap(rhs.right_index);
+  }
+
+  // Вставка пары (left, right), возвращает итератор на left.
+  // Если такой left или такой right уже присутствуют, вставка не
+  // производится и возвращается end_left().
+  template <typename L = Left, typename R = Right>
+  left_iterator insert(L&& left, R&& right) {
+    std::size_t left_hash = left_index.hash_of(left);
+    if (left_index.find(left, left_hash) != npos) {
+      return end_left();
+    }
+    std::size_t right_hash = right_index.hash_of(right);
+    if (right_index.find(right, right_hash) != npos) {
+      return end_left();
+    }
+    left_index.reserve_one();
+    right_index.reserve_one();
+    data_node* node = create_node(std::forward<L>(left), std::forward<R>(right));
+    left_index.place(node, left_hash);
+    right_index.place(node, right_hash);
+    elements_num++;
+    return {this, node->left_pos};
+  }
+
+  // Удаляет элемент и соответствующий ему парный, возвращает итератор на
+  // следующий элемент. erase(end_left()) и erase(end_right()) не определены.
+  left_iterator erase_left(left_iterator it) {
+    std::size_t next = it.pos;
+    erase_node(it.node());
+    return {this, left_index.next_occupied(next + 1)};
+  }
+
+  right_iterator erase_right(right_iterator it) {
+    std::size_t next = it.pos;
+    erase_node(it.node());
+    return {this, right_index.next_occupied(next + 1)};
+  }
+
+  // Удаляет пару по ключу, если она есть. Возвращает, была ли пара удалена.
+  bool erase_left(const left_t& left) {
+    auto it = find_left(left);
+    if (it.is_end()) {
+      return false;
+    }
+    erase_node(it.node());
+    return true;
+  }
+
+  bool erase_right(const right_t& right) {
+    auto it = find_right(right);
+    if (it.is_end()) {
+      return false;
+    }
+    erase_node(it.node());
+    return true;
+  }
+
+  // Возвращает итератор по элементу. Если не найден - соответствующий end()
+  left_iterator find_left(const left_t& left) const {
+    std::size_t pos = left_index.find(left, left_index.hash_of(left));
+    return {this, pos == npos ? left_index.capacity() : pos};
+  }
+
+  right_iterator find_right(const right_t& right) const {
+    std::size_t pos = right_index.find(right, right_index.hash_of(right));
+    return {this, pos == npos ? right_index.capacity() : pos};
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  const right_t& at_left(const left_t& key) const {
+    auto it = find_left(key);
+    if (it.is_end()) {
+      throw std::out_of_range("key not found");
+    }
+    return it.node()->right_key;
+  }
+
+  const left_t& at_right(const right_t& key) const {
+    auto it = find_right(key);
+    if (it.is_end()) {
+      throw std::out_of_range("key not found");
+    }
+    return it.node()->left_key;
+  }
+
+  // Как в bimap: если key нет, добавляет пару (key, Right()), а если
+  // Right() уже занят, перевешивает его пару на key.
+  template <typename checker = right_t>
+    requires(std::is_default_constructible_v<checker>)
+  const right_t& at_left_or_default(const left_t& key) {
+    auto it = find_left(key);
+    if (!it.is_end()) {
+      return it.node()->right_key;
+    }
+    Right def = Right();
+    auto def_it = find_right(def);
+    if (def_it.is_end()) {
+      return *insert(key, std::move(def)).flip();
+    }
+    Left new_key(key);
+    left_index.reserve_one();
+    data_node* node = def_it.node();
+    left_index.erase(node->left_pos);
+    node->left_key.~Left();
+    new (&node->left_key) Left(std::move(new_key));
+    left_index.place(node, left_index.hash_of(node->left_key));
+    return node->right_key;
+  }
+
+  template <typename checker = left_t>
+    requires(std::is_default_constructible_v<checker>)
+  const left_t& at_right_or_default(const right_t& key) {
+    auto it = find_right(key);
+    if (!it.is_end()) {
+      return it.node()->left_key;
+    }
+    Left def = Left();
+    auto def_it = find_left(def);
+    if (def_it.is_end()) {
+      return *insert(std::move(def), key);
+    }
+    Right new_key(key);
+    right_index.reserve_one();
+    data_node* node = def_it.node();
+    right_index.erase(node->right_pos);
+    node->right_key.~Right();
+    new (&node->right_key) Right(std::move(new_key));
+    right_index.place(node, right_index.hash_of(node->right_key));
+    return node->left_key;
+  }
+
+  // Готовит таблицы к count парам, чтобы вставки до этого размера не
+  // перехешировали их.
+  void reserve(std::size_t count) {
+    left_index.reserve(count);
+    right_index.reserve(count);
+  }
+
+  left_iterator begin_left() const {
+    return {this, left_index.next_occupied(0)};
+  }
+
+  left_iterator end_left() const {
+    return {this, left_index.capacity()};
+  }
+
+  right_iterator begin_right() const {
+    return {this, right_index.next_occupied(0)};
+  }
+
+  right_iterator end_right() const {
+    return {this, right_index.capacity()};
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(alloc);
+  }
+
+  bool empty() const {
+    return elements_num == 0;
+  }
+
+  std::size_t size() const {
+    return elements_num;
+  }
+
+  // Равны, если содержат одинаковые множества пар.
+  friend bool operator==(const unordered_bimap& lhs, const unordered_bimap& rhs) {
+    if (lhs.size() != rhs.size()) {
+      return false;
+    }
+    for (auto it = lhs.begin_left(); it != lhs.end_left(); ++it) {
+      auto other = rhs.find_left(*it);
+      if (other == rhs.end_left() || !lhs.right_index.get_equal()(*it.flip(), *other.flip())) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend bool operator!=(const unordered_bimap& lhs, const unordered_bimap& rhs) {
+    return !(lhs == rhs);
+  }
+
+private:
+  using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<data_node>;
+  using node_alloc_traits = std::allocator_traits<node_allocator>;
+
+  template <typename Tag>
+  const hash_index<Tag>& index() const noexcept {
+    if constexpr (std::is_same_v<Tag, left>) {
+      return left_index;
+    } else {
+      return right_index;
+    }
+  }
+
+  template <typename L, typename R>
+  data_node* create_node(L&& left, R&& right) {
+    data_node* node = node_alloc_traits::allocate(alloc, 1);
+    try {
+      node_alloc_traits::construct(alloc, node, std::forward<L>(left), std::forward<R>(right));
+    } catch (...) {
+      node_alloc_traits::deallocate(alloc, node, 1);
+      throw;
+    }
+    return node;
+  }
+
+  void destroy_node(data_node* node) noexcept {
+    node_alloc_traits::destroy(alloc, node);
+    node_alloc_traits::deallocate(alloc, node, 1);
+  }
+
+  void erase_node(data_node* node) noexcept {
+    left_index.erase(node->left_pos);
+    right_index.erase(node->right_pos);
+    destroy_node(node);
+    elements_num--;
+  }
+
+  std::size_t elements_num{0};
+  [[no_unique_address]] node_allocator alloc;
+  hash_index<left> left_index;
+  hash_index<right> right_index;
+};
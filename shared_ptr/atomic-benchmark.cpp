@@ -0,0 +1,343 @@
+// Нагрузочная проверка и бенчмарк atomic_shared_ptr в сравнении с shared_ptr
+// под std::mutex.
+//
+// Сборка и запуск:
+//   cd shared_ptr
+//   g++ -std=c++20 -O2 -DNDEBUG -pthread -I . atomic-benchmark.cpp control_block_base.cpp -o atomic-benchmark
+//   ./atomic-benchmark [--threads N] [--millis N]
+//
+// Сначала идет проверка: читатели непрерывно загружают снимок и сверяют его
+// содержимое, писатели заменяют его через store, exchange и
+// compare_exchange_strong. В конце все снимки должны быть уничтожены ровно
+// по разу. Перед ней те же проверки проходят детерминированные сценарии:
+// читатель занял узел, а писатель заменил слово и стоит до переноса займов,
+// пока читатель не закончит. При нарушении программа печатает причину и
+// завершается с кодом 1.
+// Для поиска гонок ту же программу стоит собрать с -fsanitize=thread.
+//
+// Затем для 1, 2, 4, ... до --threads (по умолчанию hardware_concurrency)
+// потоков меряется число загрузок в секунду у обоих вариантов: без писателя
+// и с одним писателем, который заменяет снимок непрерывно. Каждый замер идет
+// --millis миллисекунд (по умолчанию 200). Результат -- таблица в stdout.
+
+#include <atomic>
+
+namespace hooks {
+// Обработчик точек ATOMIC_SHARED_PTR_HOOK текущего потока; пустой вне
+// детерминированных сценариев.
+thread_local void (*on_point)(const char* point) = nullptr;
+} // namespace hooks
+
+#define ATOMIC_SHARED_PTR_HOOK(point) (hooks::on_point ? hooks::on_point(#point) : void())
+
+#include "atomic-shared-ptr.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<std::int64_t> alive{0};
+
+// Снимок с избыточным содержимым: по любому полю восстанавливаются остальные,
+// так что чтение разрушенного или недостроенного снимка заметно.
+struct snapshot {
+  explicit snapshot(std::uint64_t version) : version(version) {
+    for (std::size_t i = 0; i < std::size(routes); i++) {
+      routes[i] = version * 31 + i;
+    }
+    alive.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  snapshot(const snapshot&) = delete;
+
+  ~snapshot() {
+    version = ~std::uint64_t{0};
+    alive.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  bool valid() const {
+    for (std::size_t i = 0; i < std::size(routes); i++) {
+      if (routes[i] != version * 31 + i) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::uint64_t version;
+  std::uint64_t routes[6];
+};
+
+using snapshot_ptr = shared_ptr<const snapshot>;
+
+[[noreturn]] void fail(const char* what) {
+  std::fprintf(stderr, "stress: %s\n", what);
+  std::exit(1);
+}
+
+// Этап детерминированного сценария, которого дождались оба потока.
+std::atomic<int> stage{0};
+// Точка, в которой писатель сценария ждет читателя, снятый в ней снимок и
+// число ссылок на него, которые держит сам писатель.
+const char* writer_pause = nullptr;
+const weak_ptr<const snapshot>* removed = nullptr;
+std::size_t writer_refs = 0;
+const char* scenario = nullptr;
+
+void wait_stage(int target) {
+  while (stage.load() < target) {
+    std::this_thread::yield();
+  }
+}
+
+// Читатель занимает узел и ждет, пока писатель заменит слово (этапы 1 и 2);
+// писатель ждет, пока читатель вернет заем в уже снятый узел (этап 3), и
+// только потом переносит займы. Снимок должен пережить обоих и уничтожиться
+// ровно один раз.
+void ordered_removal(const char* what, const char* writer_point, std::size_t own_refs,
+                     const std::function<void(atomic_shared_ptr<const snapshot>&, snapshot_ptr)>& write) {
+  {
+    snapshot_ptr first = make_shared<const snapshot>(1);
+    atomic_shared_ptr<const snapshot> current(first);
+    weak_ptr<const snapshot> watch = first;
+    first.reset();
+    stage = 0;
+    writer_pause = writer_point;
+    removed = &watch;
+    writer_refs = own_refs;
+    scenario = what;
+
+    std::thread reader([&] {
+      hooks::on_point = [](const char* point) {
+        if (std::strcmp(point, "load_borrowed") == 0) {
+          stage = 1;
+          wait_stage(2);
+        }
+      };
+      snapshot_ptr cur = current.load();
+      hooks::on_point = nullptr;
+      if (!cur || !cur->valid() || cur->version != 1) {
+        fail(what);
+      }
+      // Без своей ссылки читателя снимок держит только снятый узел.
+      cur.reset();
+      stage = 3;
+    });
+    std::thread writer([&] {
+      wait_stage(1);
+      hooks::on_point = [](const char* point) {
+        if (std::strcmp(point, writer_pause) == 0) {
+          stage = 2;
+          wait_stage(3);
+          // Читатель уже отпустил и заем, и свою ссылку; кроме писателя,
+          // снимок держит только снятый узел, займы в который еще не
+          // перенесены.
+          if (removed->use_count() != writer_refs + 1) {
+            fail(scenario);
+          }
+        }
+      };
+      write(current, make_shared<const snapshot>(2));
+      hooks::on_point = nullptr;
+    });
+    reader.join();
+    writer.join();
+
+    if (watch.lock() || alive.load() != 1) {
+      fail(what);
+    }
+  }
+  if (alive.load() != 0) {
+    fail(what);
+  }
+}
+
+void ordered_removals() {
+  ordered_removal("store: узел освобожден до переноса займов", "exchange_swapped", 0,
+                  [](atomic_shared_ptr<const snapshot>& current, snapshot_ptr fresh) { current.store(fresh); });
+  ordered_removal("exchange: узел освобожден до переноса займов", "exchange_swapped", 0,
+                  [](atomic_shared_ptr<const snapshot>& current, snapshot_ptr fresh) {
+                    if (snapshot_ptr old = current.exchange(fresh); !old || old->version != 1) {
+                      fail("exchange вернул не тот снимок");
+                    }
+                  });
+  ordered_removal("compare_exchange_strong: узел освобожден до переноса займов", "compare_exchanged", 1,
+                  [](atomic_shared_ptr<const snapshot>& current, snapshot_ptr fresh) {
+                    snapshot_ptr expected = current.load();
+                    if (!current.compare_exchange_strong(expected, fresh)) {
+                      fail("compare_exchange_strong не заменил снимок");
+                    }
+                  });
+}
+
+void stress(unsigned threads, std::chrono::milliseconds duration) {
+  {
+    atomic_shared_ptr<const snapshot> current(make_shared<const snapshot>(0));
+    std::atomic<std::uint64_t> next_version{1};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> workers;
+    unsigned writers = std::max(1u, threads / 4);
+    unsigned readers = std::max(1u, threads - writers);
+
+    for (unsigned i = 0; i < readers; i++) {
+      workers.emplace_back([&] {
+        while (!stop.load(std::memory_order_relaxed)) {
+          snapshot_ptr cur = current.load();
+          if (!cur || !cur->valid()) {
+            fail("load вернул пустой или испорченный снимок");
+          }
+        }
+      });
+    }
+    for (unsigned i = 0; i < writers; i++) {
+      workers.emplace_back([&, i] {
+        std::uint64_t step = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+          std::uint64_t version = next_version.fetch_add(1, std::memory_order_relaxed);
+          snapshot_ptr fresh = make_shared<const snapshot>(version);
+          switch ((step++ + i) % 3) {
+          case 0:
+            current.store(fresh);
+            break;
+          case 1:
+            if (snapshot_ptr old = current.exchange(fresh); !old || !old->valid()) {
+              fail("exchange вернул пустой или испорченный снимок");
+            }
+            break;
+          default: {
+            snapshot_ptr expected = current.load();
+            snapshot_ptr seen = expected;
+            if (current.compare_exchange_strong(expected, fresh)) {
+              if (expected != seen) {
+                fail("compare_exchange_strong изменил expected при успехе");
+              }
+            } else if (!expected || !expected->valid()) {
+              fail("compare_exchange_strong вернул испорченный снимок");
+            }
+          }
+          }
+        }
+      });
+    }
+    std::this_thread::sleep_for(duration);
+    stop.store(true);
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+
+    snapshot_ptr last = current.load();
+    if (!last || !last->valid() || last.use_count() != 2) {
+      fail("после остановки снимок поврежден или лишние ссылки");
+    }
+    snapshot_ptr other = make_shared<const snapshot>(0);
+    snapshot_ptr wrong = other;
+    if (current.compare_exchange_strong(wrong, other) || wrong != last) {
+      fail("compare_exchange_strong с неверным expected");
+    }
+    wrong.reset();
+    current.store(nullptr);
+    if (current.load() || last.use_count() != 1) {
+      fail("store(nullptr) не отпустил снимок");
+    }
+  }
+  if (alive.load() != 0) {
+    fail("не все снимки уничтожены");
+  }
+}
+
+// Базовый вариант: shared_ptr под мьютексом.
+class locked_shared_ptr {
+public:
+  explicit locked_shared_ptr(snapshot_ptr value) : value(std::move(value)) {}
+
+  snapshot_ptr load() const {
+    std::lock_guard lock(mutex);
+    return value;
+  }
+
+  void store(snapshot_ptr desired) {
+    std::lock_guard lock(mutex);
+    value.swap(desired);
+  }
+
+private:
+  mutable std::mutex mutex;
+  snapshot_ptr value;
+};
+
+// Загрузок в секунду у readers потоков; writer непрерывно заменяет снимок.
+template <typename Holder>
+double measure(unsigned readers, bool writer, std::chrono::milliseconds duration) {
+  Holder holder(make_shared<const snapshot>(0));
+  std::atomic<bool> stop{false};
+  std::atomic<std::uint64_t> loads{0};
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < readers; i++) {
+    workers.emplace_back([&] {
+      std::uint64_t count = 0;
+      std::uint64_t sum = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        sum += holder.load()->version;
+        count++;
+      }
+      loads.fetch_add(count + (sum == ~std::uint64_t{0}), std::memory_order_relaxed);
+    });
+  }
+  if (writer) {
+    workers.emplace_back([&] {
+      std::uint64_t version = 1;
+      while (!stop.load(std::memory_order_relaxed)) {
+        holder.store(make_shared<const snapshot>(version++));
+      }
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(duration);
+  stop.store(true);
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(loads.load()) / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  long millis = 200;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--threads") == 0) {
+      threads = static_cast<unsigned>(std::max(1l, std::atol(argv[i + 1])));
+    } else if (std::strcmp(argv[i], "--millis") == 0) {
+      millis = std::max(1l, std::atol(argv[i + 1]));
+    }
+  }
+  std::chrono::milliseconds duration(millis);
+
+  ordered_removals();
+  stress(std::max(threads, 4u), duration * 5);
+  std::printf("stress: ok\n\n");
+
+  std::printf("%7s %7s %16s %16s %8s\n", "readers", "writer", "atomic loads/s", "mutex loads/s", "ratio");
+  for (unsigned readers = 1;; readers = std::min(readers * 2, threads)) {
+    for (bool writer : {false, true}) {
+      double atomic = measure<atomic_shared_ptr<const snapshot>>(readers, writer, duration);
+      double locked = measure<locked_shared_ptr>(readers, writer, duration);
+      std::printf("%7u %7s %16.0f %16.0f %8.2f\n", readers, writer ? "yes" : "no", atomic, locked, atomic / locked);
+    }
+    if (readers == threads) {
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "shared-ptr.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+// Точки, в которых проверка порядка операций может придержать поток: после
+// займа в load и после замены слова в exchange и compare_exchange_strong. По
+// умолчанию пустые; atomic-benchmark.cpp определяет макрос до подключения
+// заголовка, чтобы воспроизводить гонки снятия узла детерминированно.
+#ifndef ATOMIC_SHARED_PTR_HOOK
+#define ATOMIC_SHARED_PTR_HOOK(point)
+#endif
+
+// Атомарный shared_ptr для публикации снимков, которые часто читают и редко
+// заменяют. Установленное значение лежит в неизменяемом узле, а в атомарном
+// слове хранятся адрес узла (младшие 48 бит) и число займов (старшие 16 бит):
+// это разделенный счетчик ссылок. load занимает узел одним fetch_add, копирует
+// из него shared_ptr и возвращает заем CAS-ом, если узел все еще установлен.
+// Собственный счетчик установленного узла равен нулю. Читатель, который
+// застал узел уже снятым, вычитает из счетчика единицу, и тот может уйти в
+// минус; снявший узел прибавляет число займов из старого слова одной
+// операцией. Узел освобождает тот, кто вернул счетчик ровно в ноль, поэтому
+// узел не освобождается, пока его читают, в каком бы порядке ни шли снятие и
+// возвраты займов. Ни одна операция не берет блокировку.
+//
+// Каждый store выделяет узел из block_pool_allocator. Одновременно занимать
+// один узел могут не больше 65535 вызовов load. Адреса в пространстве
+// пользователя должны помещаться в 48 бит, как на x86-64 и AArch64.
+template <typename T>
+class atomic_shared_ptr {
+  using value_type = shared_ptr<T, atomic_refcount>;
+
+  struct node {
+    explicit node(value_type value) noexcept : value(std::move(value)) {}
+
+    const value_type value;
+    // Ноль, пока узел установлен; после снятия -- займы, которые еще не
+    // возвращены.
+    std::atomic<std::int64_t> refs{0};
+  };
+
+  using node_allocator = block_pool_allocator<node>;
+
+  static_assert(sizeof(void*) == sizeof(std::uint64_t), "atomic_shared_ptr хранит адрес в 64-битном слове");
+
+  static constexpr unsigned address_bits = 48;
+  static constexpr std::uint64_t address_mask = (std::uint64_t{1} << address_bits) - 1;
+  static constexpr std::uint64_t borrow = std::uint64_t{1} << address_bits;
+
+public:
+  static constexpr bool is_always_lock_free = std::atomic<std::uint64_t>::is_always_lock_free;
+
+  atomic_shared_ptr() noexcept : word(0) {}
+
+  atomic_shared_ptr(value_type desired) : word(pack(make_node(std::move(desired)))) {}
+
+  atomic_shared_ptr(const atomic_shared_ptr&) = delete;
+  atomic_shared_ptr& operator=(const atomic_shared_ptr&) = delete;
+
+  ~atomic_shared_ptr() {
+    std::uint64_t cur = word.load(std::memory_order_acquire);
+    release(address(cur), borrows(cur));
+  }
+
+  atomic_shared_ptr& operator=(value_type desired) {
+    store(std::move(desired));
+    return *this;
+  }
+
+  operator value_type() const noexcept {
+    return load();
+  }
+
+  bool is_lock_free() const noexcept {
+    return word.is_lock_free();
+  }
+
+  value_type load() const noexcept {
+    node* cur = address(word.fetch_add(borrow, std::memory_order_acquire));
+    value_type res = cur ? cur->value : value_type();
+    ATOMIC_SHARED_PTR_HOOK(load_borrowed);
+    return_borrow(cur);
+    return res;
+  }
+
+  void store(value_type desired) {
+    exchange(std::move(desired));
+  }
+
+  value_type exchange(value_type desired) {
+    std::uint64_t old = word.exchange(pack(make_node(std::move(desired))), std::memory_order_acq_rel);
+    ATOMIC_SHARED_PTR_HOOK(exchange_swapped);
+    node* cur = address(old);
+    if (cur == nullptr) {
+      return value_type();
+    }
+    // Значение копируется до переноса займов: до него счетчик не выше нуля,
+    // и узел никто, кроме нас, не освободит.
+    value_type res = cur->value;
+    release(cur, borrows(old));
+    return res;
+  }
+
+  // Сравнивает как std::atomic<std::shared_ptr>: значения равны, если у них
+  // один указатель и один блок управления. При неудаче expected получает
+  // текущее значение. Ложных неудач нет, поэтому слабая версия совпадает с
+  // сильной.
+  bool compare_exchange_strong(value_type& expected, value_type desired) {
+    node* fresh = make_node(std::move(desired));
+    while (true) {
+      std::uint64_t cur = word.fetch_add(borrow, std::memory_order_acquire) + borrow;
+      node* installed = address(cur);
+      if (!equal(installed, expected)) {
+        expected = installed ? installed->value : value_type();
+        return_borrow(installed);
+        release(fresh, 0);
+        return false;
+      }
+      while (address(cur) == installed) {
+        if (word.compare_exchange_weak(cur, pack(fresh), std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          ATOMIC_SHARED_PTR_HOOK(compare_exchanged);
+          // Свой заем переносится вместе с чужими и тут же возвращается.
+          release(installed, borrows(cur) - 1);
+          return true;
+        }
+      }
+      // Узел сняли другим store, и наш заем возвращается в его счетчик.
+      release(installed, -1);
+    }
+  }
+
+  bool compare_exchange_weak(value_type& expected, value_type desired) {
+    return compare_exchange_strong(expected, std::move(desired));
+  }
+
+private:
+  static node* make_node(value_type value) {
+    if (!value.cb) {
+      return nullptr;
+    }
+    node* res = node_allocator().allocate(1);
+    new (res) node(std::move(value));
+    return res;
+  }
+
+  // Прибавляет delta к счетчику узла и освобождает узел, если счетчик стал
+  // нулем. Снявший узел передает число займов из старого слова, читатель,
+  // чей заем уже не вернуть в слово, -- минус единицу.
+  static void release(node* cur, std::int64_t delta) noexcept {
+    if (cur != nullptr && cur->refs.fetch_add(delta, std::memory_order_acq_rel) + delta == 0) {
+      cur->~node();
+      node_allocator().deallocate(cur, 1);
+    }
+  }
+
+  static std::int64_t borrows(std::uint64_t cur) noexcept {
+    return static_cast<std::int64_t>(cur >> address_bits);
+  }
+
+  // Пока узел установлен, заем возвращается в слово; после снятия -- в
+  // счетчик узла. release в слове упорядочивает чтение узла перед его
+  // освобождением тем, кто снимет узел.
+  void return_borrow(node* cur) const noexcept {
+    std::uint64_t expected = word.load(std::memory_order_relaxed);
+    while (address(expected) == cur) {
+      if (word.compare_exchange_weak(expected, expected - borrow, std::memory_order_release,
+                                     std::memory_order_relaxed)) {
+        return;
+      }
+    }
+    release(cur, -1);
+  }
+
+  static bool equal(const node* cur, const value_type& value) noexcept {
+    return cur ? cur->value.cb == value.cb && cur->value.ptr == value.ptr : value.cb == nullptr && value.ptr == nullptr;
+  }
+
+  static std::uint64_t pack(node* cur) noexcept {
+    return reinterpret_cast<std::uintptr_t>(cur);
+  }
+
+  static node* address(std::uint64_t cur) noexcept {
+    return reinterpret_cast<node*>(static_cast<std::uintptr_t>(cur & address_mask));
+  }
+
+  mutable std::atomic<std::uint64_t> word;
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+namespace detail {
+// Пул слотов размера Size, общий для всех типов, которые в него попадают.
+// У каждого потока свой кеш свободных слотов, так что выделение и
+// освобождение -- это операции со списком без блокировок. Кеш обменивается
+// с общим складом пачками по batch_size слотов: пустой кеш берет пачку,
+// переполненный отдает. Когда и склад пуст, пул выделяет у системы кусок на
+// batches_per_chunk пачек. Память кусков не возвращается системе.
+template <std::size_t Size>
+class slot_pool {
+  union slot {
+    struct {
+      slot* next;
+      // У первого слота пачки на складе: следующая пачка и размер этой.
+      slot* next_batch;
+      std::size_t batch_count;
+    } link;
+
+    alignas(std::max_align_t) std::byte data[Size];
+  };
+
+  static constexpr std::size_t batch_size = std::max<std::size_t>(8, 4096 / sizeof(slot));
+  static constexpr std::size_t batches_per_chunk = 16;
+
+  struct depot {
+    std::mutex lock;
+    slot* batches{nullptr};
+  };
+
+  // Тривиально разрушаемый, поэтому остается доступным, пока поток
+  // завершается: после сдачи на склад closed == true, и освобождения идут
+  // сразу на склад.
+  struct cache {
+    slot* free_list;
+    std::size_t count;
+    bool closed;
+  };
+
+  // Сдает кеш потока на склад при завершении потока.
+  struct cache_guard {
+    ~cache_guard() {
+      if (local.count != 0) {
+        push_batch(local.free_list, local.count);
+      }
+      local.free_list = nullptr;
+      local.count = 0;
+      local.closed = true;
+    }
+
+    void touch() noexcept {}
+  };
+
+public:
+  static void* allocate() {
+    cache& cur = local;
+    if (cur.free_list == nullptr) {
+      refill(cur);
+    }
+    slot* res = cur.free_list;
+    cur.free_list = res->link.next;
+    cur.count--;
+    if (cur.closed && cur.count != 0) {
+      push_batch(cur.free_list, cur.count);
+      cur.free_list = nullptr;
+      cur.count = 0;
+    }
+    return res;
+  }
+
+  static void deallocate(void* ptr) noexcept {
+    slot* freed = static_cast<slot*>(ptr);
+    cache& cur = local;
+    if (cur.closed) {
+      freed->link.next = nullptr;
+      push_batch(freed, 1);
+      return;
+    }
+    freed->link.next = cur.free_list;
+    cur.free_list = freed;
+    cur.count++;
+    if (cur.count >= 2 * batch_size) {
+      release_batch(cur);
+    }
+  }
+
+private:
+  // Склад нужен и освобождениям из деструкторов статических объектов,
+  // поэтому он никогда не уничтожается.
+  static depot& get_depot() {
+    static depot* instance = new depot();
+    return *instance;
+  }
+
+  static void push_batch(slot* first, std::size_t count) noexcept {
+    depot& dep = get_depot();
+    first->link.batch_count = count;
+    std::lock_guard lock(dep.lock);
+    first->link.next_batch = dep.batches;
+    dep.batches = first;
+  }
+
+  static void refill(cache& cur) {
+    if (!cur.closed) {
+      guard.touch();
+    }
+    depot& dep = get_depot();
+    {
+      std::lock_guard lock(dep.lock);
+      if (dep.batches != nullptr) {
+        slot* batch = dep.batches;
+        dep.batches = batch->link.next_batch;
+        cur.free_list = batch;
+        cur.count = batch->link.batch_count;
+        return;
+      }
+    }
+    slot* chunk = static_cast<slot*>(::operator new(sizeof(slot) * batch_size * batches_per_chunk));
+    for (std::size_t i = 0; i < batch_size * batches_per_chunk; i++) {
+      chunk[i].link.next = (i + 1) % batch_size == 0 ? nullptr : &chunk[i + 1];
+    }
+    for (std::size_t i = 1; i < batches_per_chunk; i++) {
+      push_batch(&chunk[i * batch_size], batch_size);
+    }
+    cur.free_list = chunk;
+    cur.count = batch_size;
+  }
+
+  static void release_batch(cache& cur) noexcept {
+    slot* first = cur.free_list;
+    slot* last = first;
+    for (std::size_t i = 1; i < batch_size; i++) {
+      last = last->link.next;
+    }
+    cur.free_list = last->link.next;
+    cur.count -= batch_size;
+    last->link.next = nullptr;
+    push_batch(first, batch_size);
+  }
+
+  static inline thread_local cache local{};
+  static inline thread_local cache_guard guard;
+};
+} // namespace detail
+
+// Аллокатор одиночных объектов из потоковых кешей detail::slot_pool.
+// Объекты округляются до размера, кратного alignof(std::max_align_t), и
+// типы одного размера делят один пул. Все копии равны: память, выделенную в
+// одном потоке, можно освобождать в другом. Массивы и типы с выравниванием
+// больше alignof(std::max_align_t) передаются std::allocator.
+// Этим аллокатором по умолчанию выделяются блоки управления shared_ptr.
+template <typename T>
+class block_pool_allocator {
+  static constexpr std::size_t slot_size =
+      (std::max(sizeof(T), 3 * sizeof(void*)) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) *
+      alignof(std::max_align_t);
+  static constexpr bool pooled = alignof(T) <= alignof(std::max_align_t);
+
+  using pool = detail::slot_pool<slot_size>;
+
+public:
+  using value_type = T;
+  using is_always_equal = std::true_type;
+
+  block_pool_allocator() noexcept = default;
+
+  template <typename U>
+  block_pool_allocator(const block_pool_allocator<U>&) noexcept {}
+
+  T* allocate(std::size_t n) {
+    if constexpr (pooled) {
+      if (n == 1) {
+        return static_cast<T*>(pool::allocate());
+      }
+    }
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* ptr, std::size_t n) noexcept {
+    if constexpr (pooled) {
+      if (n == 1) {
+        pool::deallocate(ptr);
+        return;
+      }
+    }
+    std::allocator<T>().deallocate(ptr, n);
+  }
+
+  friend bool operator==(const block_pool_allocator&, const block_pool_allocator&) noexcept {
+    return true;
+  }
+
+  friend bool operator!=(const block_pool_allocator&, const block_pool_allocator&) noexcept {
+    return false;
+  }
+};
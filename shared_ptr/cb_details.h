@@ -1,50 +1,188 @@
 #pragma once
 
+#include "block-pool.h"
+
+#include <atomic>
 #include <cstddef>
 #include <memory>
 
 namespace detail {
+// Счетчики ссылок для указателей, которые копируются и уничтожаются в разных
+// потоках. Новая ссылка всегда делается из уже существующей, поэтому
+// увеличение не упорядочивает память. Уменьшение -- acq_rel: тот, кто
+// обнулил счетчик, видит все записи, сделанные через другие ссылки.
+struct atomic_refcount {
+  using counter = std::atomic<size_t>;
+
+  static void increment(counter& cnt) noexcept {
+    cnt.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Возвращает true, если счетчик стал нулем.
+  static bool decrement(counter& cnt) noexcept {
+    return cnt.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+
+  // Увеличивает счетчик, только если он не ноль: обнуленный счетчик
+  // означает, что объект уже уничтожается, и воскрешать его нельзя.
+  static bool increment_if_nonzero(counter& cnt) noexcept {
+    size_t cur = cnt.load(std::memory_order_relaxed);
+    do {
+      if (cur == 0) {
+        return false;
+      }
+    } while (!cnt.compare_exchange_weak(cur, cur + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+    return true;
+  }
+
+  static size_t load(const counter& cnt) noexcept {
+    return cnt.load(std::memory_order_relaxed);
+  }
+};
+
+// Обычные счетчики для указателей, которые живут в одном потоке.
+struct local_refcount {
+  using counter = size_t;
+
+  static void increment(counter& cnt) noexcept {
+    cnt++;
+  }
+
+  static bool decrement(counter& cnt) noexcept {
+    return --cnt == 0;
+  }
+
+  static bool increment_if_nonzero(counter& cnt) noexcept {
+    if (cnt == 0) {
+      return false;
+    }
+    cnt++;
+    return true;
+  }
+
+  static size_t load(const counter& cnt) noexcept {
+    return cnt;
+  }
+};
+
+// Общая часть блоков управления. Вместо таблицы виртуальных функций блок
+// хранит пару указателей на функции своего типа: clear_fn уничтожает объект,
+// dispose_fn освобождает сам блок. Изменения счетчиков определены здесь и
+// встраиваются в место вызова, а последние освобождения вынесены в
+// control_block_base.cpp.
+template <typename Refcount>
 struct control_block {
-  virtual void clear() = 0;
-  virtual ~control_block();
+  using action = void (*)(control_block*) noexcept;
 
-  void check_lifetime();
+  control_block(action clear_fn, action dispose_fn) noexcept : clear_fn(clear_fn), dispose_fn(dispose_fn) {}
 
-  void inc_strong();
+  control_block(const control_block&) = delete;
+  control_block& operator=(const control_block&) = delete;
 
-  void inc_weak();
+  void inc_strong() noexcept {
+    Refcount::increment(strong_ref_count);
+  }
 
-  void dec_strong();
+  // Для weak_ptr::lock: увеличивает счетчик сильных ссылок, если объект
+  // еще жив, и возвращает, удалось ли.
+  bool inc_strong_if_alive() noexcept {
+    return Refcount::increment_if_nonzero(strong_ref_count);
+  }
 
-  void dec_weak();
+  void inc_weak() noexcept {
+    Refcount::increment(weak_ref_count);
+  }
 
-  size_t get_str_ref_cnt();
+  void dec_strong() noexcept {
+    if (Refcount::decrement(strong_ref_count)) {
+      release_object();
+    }
+  }
+
+  void dec_weak() noexcept {
+    if (Refcount::decrement(weak_ref_count)) {
+      release_block();
+    }
+  }
+
+  size_t get_str_ref_cnt() const noexcept {
+    return Refcount::load(strong_ref_count);
+  }
 
 private:
-  size_t strong_ref_count{1};
-  size_t weak_ref_count{};
+  // Уничтожает объект и отпускает общую слабую ссылку сильных.
+  void release_object() noexcept;
+
+  void release_block() noexcept;
+
+  action clear_fn;
+  action dispose_fn;
+  typename Refcount::counter strong_ref_count{1};
+  // Слабые ссылки плюс одна общая на все сильные, так что блок удаляется
+  // ровно одним потоком и только после уничтожения объекта.
+  typename Refcount::counter weak_ref_count{1};
 };
 
-template <typename T, typename D = std::default_delete<T>>
-struct control_block_ptr : control_block {
+// Блоки хранят копию аллокатора, которым были выделены, и освобождаются
+// через нее. create_block выделяет блок через Alloc, перепривязанный к
+// Block, и конструирует его из (alloc, args...); если конструктор бросает
+// исключение, память возвращается.
+template <typename Block, typename Alloc, typename... Args>
+Block* create_block(const Alloc& alloc, Args&&... args) {
+  using traits = typename std::allocator_traits<Alloc>::template rebind_traits<Block>;
+  typename traits::allocator_type block_alloc(alloc);
+  Block* res = traits::allocate(block_alloc, 1);
+  try {
+    new (res) Block(alloc, std::forward<Args>(args)...);
+  } catch (...) {
+    traits::deallocate(block_alloc, res, 1);
+    throw;
+  }
+  return res;
+}
+
+template <typename Block, typename Alloc>
+void destroy_block(Block* block, const Alloc& alloc) noexcept {
+  using traits = typename std::allocator_traits<Alloc>::template rebind_traits<Block>;
+  typename traits::allocator_type block_alloc(alloc);
+  block->~Block();
+  traits::deallocate(block_alloc, block, 1);
+}
+
+template <typename T, typename D = std::default_delete<T>, typename Refcount = atomic_refcount,
+          typename Alloc = block_pool_allocator<T>>
+struct control_block_ptr : control_block<Refcount> {
 public:
-  control_block_ptr(T* _ptr, D&& del) : ptr(_ptr), deleter(std::move(del)) {}
-
-  ~control_block_ptr() override = default;
+  // alloc копируется до перемещения del: если копия бросит, вызывающий
+  // удалит объект еще целым deleter.
+  control_block_ptr(const Alloc& alloc, T* _ptr, D&& del)
+      : control_block<Refcount>(&clear, &dispose),
+        ptr(_ptr),
+        alloc(alloc),
+        deleter(std::move(del)) {}
 
 private:
-  void clear() override {
-    deleter(ptr);
+  static void clear(control_block<Refcount>* cb) noexcept {
+    auto* self = static_cast<control_block_ptr*>(cb);
+    self->deleter(self->ptr);
+  }
+
+  static void dispose(control_block<Refcount>* cb) noexcept {
+    auto* self = static_cast<control_block_ptr*>(cb);
+    destroy_block(self, Alloc(std::move(self->alloc)));
   }
 
   T* ptr;
+  [[no_unique_address]] Alloc alloc;
   [[no_unique_address]] D deleter;
 };
 
-template <typename T>
-struct control_block_obj : control_block {
+template <typename T, typename Refcount = atomic_refcount, typename Alloc = block_pool_allocator<T>>
+struct control_block_obj : control_block<Refcount> {
   template <typename... Args>
-  explicit control_block_obj(Args&&... args) {
+  explicit control_block_obj(const Alloc& alloc, Args&&... args)
+      : control_block<Refcount>(&clear, &dispose),
+        alloc(alloc) {
     new (&data) T(std::forward<Args>(args)...);
   }
 
@@ -52,13 +190,17 @@ struct control_block_obj : control_block {
     return std::launder(reinterpret_cast<T*>(data));
   }
 
-  ~control_block_obj() override = default;
-
 private:
-  void clear() override {
-    std::launder(get_ptr())->~T();
+  static void clear(control_block<Refcount>* cb) noexcept {
+    static_cast<control_block_obj*>(cb)->get_ptr()->~T();
+  }
+
+  static void dispose(control_block<Refcount>* cb) noexcept {
+    auto* self = static_cast<control_block_obj*>(cb);
+    destroy_block(self, Alloc(std::move(self->alloc)));
   }
 
+  [[no_unique_address]] Alloc alloc;
   alignas(T) std::byte data[sizeof(T)];
 };
 } // namespace detail
@@ -1,34 +1,16 @@
 #include <cb_details.h>
 using namespace detail;
-control_block::~control_block() = default;
 
-void control_block::check_lifetime() {
-  if (strong_ref_count + weak_ref_count == 0) {
-    delete this;
-  }
+template <typename Refcount>
+void control_block<Refcount>::release_object() noexcept {
+  clear_fn(this);
+  dec_weak();
 }
 
-void control_block::inc_strong() {
-  strong_ref_count++;
+template <typename Refcount>
+void control_block<Refcount>::release_block() noexcept {
+  dispose_fn(this);
 }
 
-void control_block::inc_weak() {
-  weak_ref_count++;
-}
-
-void control_block::dec_strong() {
-  --strong_ref_count;
-  if (strong_ref_count == 0) {
-    clear();
-  }
-  check_lifetime();
-}
-
-void control_block::dec_weak() {
-  --weak_ref_count;
-  check_lifetime();
-}
-
-size_t control_block::get_str_ref_cnt() {
-  return strong_ref_count;
-}
+template struct detail::control_block<atomic_refcount>;
+template struct detail::control_block<local_refcount>;
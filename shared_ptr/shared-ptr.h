@@ -5,54 +5,87 @@
 #include <cstddef>
 #include <iostream>
 #include <memory>
+#include <type_traits>
 
-template <typename T>
+// Политики счетчиков ссылок. atomic_refcount (по умолчанию) позволяет
+// копировать и уничтожать указатели на один объект из разных потоков;
+// local_refcount быстрее, но все указатели на объект должны жить в одном
+// потоке. Указатели с разными политиками не преобразуются друг в друга.
+using atomic_refcount = detail::atomic_refcount;
+using local_refcount = detail::local_refcount;
+
+template <typename T, typename Refcount = atomic_refcount>
 class weak_ptr;
 
+template <typename T, typename Refcount = atomic_refcount>
+class shared_ptr;
+
 template <typename T>
+class atomic_shared_ptr;
+
+template <typename T, typename Refcount = atomic_refcount>
+class enable_shared_from_this;
+
+namespace detail {
+template <typename T, typename Refcount>
+struct allocate_shared_fn;
+} // namespace detail
+
+template <typename T, typename Refcount>
 class shared_ptr {
-  template <typename>
+  template <typename, typename>
   friend class shared_ptr;
-  template <typename>
+  template <typename, typename>
   friend class weak_ptr;
-  template <typename T1, typename... Args>
-  friend shared_ptr<T1> make_shared(Args&&... args);
+  template <typename>
+  friend class atomic_shared_ptr;
+  template <typename, typename>
+  friend struct detail::allocate_shared_fn;
 
-  using control_block = detail::control_block;
+  using control_block = detail::control_block<Refcount>;
 
 public:
   shared_ptr() noexcept : cb(nullptr), ptr(nullptr) {}
 
   shared_ptr(std::nullptr_t) noexcept : cb(nullptr), ptr(nullptr) {}
 
+  // Блоки управления по умолчанию берутся из block_pool_allocator.
   template <typename Y>
   explicit shared_ptr(Y* tempPtr) : ptr(tempPtr) {
+    using block = detail::control_block_ptr<Y, std::default_delete<Y>, Refcount>;
     try {
-      cb = new detail::control_block_ptr<Y>(tempPtr, std::default_delete<Y>());
+      cb = detail::create_block<block>(block_pool_allocator<Y>(), tempPtr, std::default_delete<Y>());
     } catch (...) {
       delete ptr;
       throw;
     }
+    enable_weak_this(tempPtr);
   }
 
   template <typename Y, typename Deleter>
-  shared_ptr(Y* ptr, Deleter deleter) : ptr(ptr) {
+  shared_ptr(Y* ptr, Deleter deleter) : shared_ptr(ptr, std::move(deleter), block_pool_allocator<Y>()) {}
+
+  // Блок управления выделяется через alloc и освобождается через его копию.
+  template <typename Y, typename Deleter, typename Alloc>
+  shared_ptr(Y* ptr, Deleter deleter, const Alloc& alloc) : ptr(ptr) {
+    using block = detail::control_block_ptr<Y, Deleter, Refcount, Alloc>;
     try {
-      cb = new detail::control_block_ptr<Y, Deleter>(ptr, std::move(deleter));
+      cb = detail::create_block<block>(alloc, ptr, std::move(deleter));
     } catch (...) {
       deleter(ptr);
       throw;
     }
+    enable_weak_this(ptr);
   }
 
   shared_ptr(const shared_ptr& other) noexcept : shared_ptr(other, other.get()) {}
 
   template <typename Y>
     requires(std::is_convertible_v<Y*, T*>)
-  shared_ptr(const shared_ptr<Y>& other) noexcept : shared_ptr(other, other.get()) {}
+  shared_ptr(const shared_ptr<Y, Refcount>& other) noexcept : shared_ptr(other, other.get()) {}
 
   template <typename Y>
-  shared_ptr(const shared_ptr<Y>& other, T* ptr) noexcept : cb(other.cb) {
+  shared_ptr(const shared_ptr<Y, Refcount>& other, T* ptr) noexcept : cb(other.cb) {
     if (cb) {
       cb->inc_strong();
     }
@@ -60,8 +93,8 @@ public:
   }
 
   template <typename Y>
-  shared_ptr(shared_ptr<Y>&& other, T* ptr) noexcept : cb(std::move(other.cb)),
-                                                       ptr(ptr) {
+  shared_ptr(shared_ptr<Y, Refcount>&& other, T* ptr) noexcept : cb(std::move(other.cb)),
+                                                                 ptr(ptr) {
     other.set_nulls();
   }
 
@@ -72,35 +105,36 @@ public:
 
   template <typename Y>
     requires(std::is_convertible_v<Y*, T*>)
-  shared_ptr(shared_ptr<Y>&& other) noexcept : shared_ptr(std::move(other), other.ptr) {}
+  shared_ptr(shared_ptr<Y, Refcount>&& other) noexcept : shared_ptr(std::move(other), other.ptr) {}
 
+  // Бросает std::bad_weak_ptr, если объект other уже уничтожен.
   template <class Y>
-  explicit shared_ptr(const weak_ptr<Y>& other) : cb(other.cb),
-                                                  ptr(other.ptr) {
-    if (cb) {
-      cb->inc_strong();
+  explicit shared_ptr(const weak_ptr<Y, Refcount>& other) : cb(other.cb),
+                                                            ptr(other.ptr) {
+    if (cb == nullptr || !cb->inc_strong_if_alive()) {
+      throw std::bad_weak_ptr();
     }
   }
 
   shared_ptr& operator=(const shared_ptr& other) noexcept {
-    shared_ptr<T>(other).swap(*this);
+    shared_ptr<T, Refcount>(other).swap(*this);
     return *this;
   }
 
   template <typename Y>
-  shared_ptr& operator=(const shared_ptr<Y>& other) noexcept {
-    shared_ptr<T>(other).swap(*this);
+  shared_ptr& operator=(const shared_ptr<Y, Refcount>& other) noexcept {
+    shared_ptr<T, Refcount>(other).swap(*this);
     return *this;
   }
 
   shared_ptr& operator=(shared_ptr&& other) noexcept {
-    shared_ptr<T>(std::move(other)).swap(*this);
+    shared_ptr<T, Refcount>(std::move(other)).swap(*this);
     return *this;
   }
 
   template <typename Y>
-  shared_ptr& operator=(shared_ptr<Y>&& other) noexcept {
-    shared_ptr<T>(std::move(other)).swap(*this);
+  shared_ptr& operator=(shared_ptr<Y, Refcount>&& other) noexcept {
+    shared_ptr<T, Refcount>(std::move(other)).swap(*this);
     return *this;
   }
 
@@ -130,12 +164,12 @@ public:
 
   template <typename Y>
   void reset(Y* new_ptr) {
-    shared_ptr<T>(new_ptr).swap(*this);
+    shared_ptr<T, Refcount>(new_ptr).swap(*this);
   }
 
   template <typename Y, typename Deleter>
   void reset(Y* new_ptr, Deleter deleter) {
-    shared_ptr<T>(new_ptr, std::move(deleter)).swap(*this);
+    shared_ptr<T, Refcount>(new_ptr, std::move(deleter)).swap(*this);
   }
 
   friend bool operator==(const shared_ptr& lhs, const shared_ptr& rhs) noexcept {
@@ -158,7 +192,36 @@ public:
   }
 
 private:
-  shared_ptr(detail::control_block_obj<T>* ptr) : cb(ptr), ptr(ptr->get_ptr()) {}
+  template <typename Alloc>
+  shared_ptr(detail::control_block_obj<T, Refcount, Alloc>* ptr) : cb(ptr), ptr(ptr->get_ptr()) {
+    enable_weak_this(this->ptr);
+  }
+
+  template <typename U>
+  static enable_shared_from_this<U, Refcount>* shared_from_this_base(enable_shared_from_this<U, Refcount>* base) {
+    return base;
+  }
+
+  // Если объект наследует enable_shared_from_this с той же политикой
+  // счетчиков и еще не принадлежит другому shared_ptr, встроенный weak_ptr
+  // привязывается к уже созданному блоку cb.
+  template <typename Y>
+  void enable_weak_this(Y* raw) noexcept {
+    using object = std::remove_cv_t<Y>;
+    if constexpr (requires(object* obj) { shared_from_this_base(obj); }) {
+      if (raw != nullptr) {
+        shared_from_this_base(const_cast<object*>(raw))->attach(cb, raw);
+      }
+    }
+  }
+
+  // Забирает уже посчитанную сильную ссылку на cb.
+  static shared_ptr adopt(control_block* cb, T* ptr) noexcept {
+    shared_ptr res;
+    res.cb = cb;
+    res.ptr = ptr;
+    return res;
+  }
 
   void set_nulls() {
     ptr = nullptr;
@@ -169,21 +232,23 @@ private:
   T* ptr;
 };
 
-template <typename T>
+template <typename T, typename Refcount>
 class weak_ptr {
-  template <typename>
+  template <typename, typename>
   friend class shared_ptr;
-  template <typename>
+  template <typename, typename>
   friend class weak_ptr;
+  template <typename, typename>
+  friend class enable_shared_from_this;
 
-  using control_block = detail::control_block;
+  using control_block = detail::control_block<Refcount>;
 
 public:
   weak_ptr() noexcept : cb(nullptr), ptr(nullptr) {}
 
   template <typename Y>
-  weak_ptr(const shared_ptr<Y>& other) noexcept : cb(other.cb),
-                                                  ptr(other.ptr) {
+  weak_ptr(const shared_ptr<Y, Refcount>& other) noexcept : cb(other.cb),
+                                                            ptr(other.ptr) {
     if (cb) {
       cb->inc_weak();
     }
@@ -196,8 +261,8 @@ public:
   }
 
   template <typename Y>
-  weak_ptr(const weak_ptr<Y>& other) noexcept : cb(other.cb),
-                                                ptr(other.ptr) {
+  weak_ptr(const weak_ptr<Y, Refcount>& other) noexcept : cb(other.cb),
+                                                          ptr(other.ptr) {
     if (cb) {
       cb->inc_weak();
     }
@@ -208,41 +273,46 @@ public:
   }
 
   template <typename Y>
-  weak_ptr(weak_ptr<Y>&& other) noexcept : cb(std::move(other.cb)),
-                                           ptr(std::move(other.ptr)) {
+  weak_ptr(weak_ptr<Y, Refcount>&& other) noexcept : cb(std::move(other.cb)),
+                                                     ptr(std::move(other.ptr)) {
     other.set_nulls();
   }
 
   template <typename Y>
-  weak_ptr& operator=(const shared_ptr<Y>& other) noexcept {
-    weak_ptr<T>(other).swap(*this);
+  weak_ptr& operator=(const shared_ptr<Y, Refcount>& other) noexcept {
+    weak_ptr<T, Refcount>(other).swap(*this);
     return *this;
   }
 
   weak_ptr& operator=(const weak_ptr& other) noexcept {
-    weak_ptr<T>(other).swap(*this);
+    weak_ptr<T, Refcount>(other).swap(*this);
     return *this;
   }
 
   template <typename Y>
-  weak_ptr& operator=(const weak_ptr<Y>& other) noexcept {
-    weak_ptr<T>(other).swap(*this);
+  weak_ptr& operator=(const weak_ptr<Y, Refcount>& other) noexcept {
+    weak_ptr<T, Refcount>(other).swap(*this);
     return *this;
   }
 
   weak_ptr& operator=(weak_ptr&& other) noexcept {
-    weak_ptr<T>(std::move(other)).swap(*this);
+    weak_ptr<T, Refcount>(std::move(other)).swap(*this);
     return *this;
   }
 
   template <typename Y>
-  weak_ptr& operator=(weak_ptr<Y>&& other) noexcept {
-    weak_ptr<T>(std::move(other)).swap(*this);
+  weak_ptr& operator=(weak_ptr<Y, Refcount>&& other) noexcept {
+    weak_ptr<T, Refcount>(std::move(other)).swap(*this);
     return *this;
   }
 
-  shared_ptr<T> lock() const noexcept {
-    return (use_count() == 0) ? shared_ptr<T>() : shared_ptr<T>(*this);
+  // Счетчик увеличивается CAS-циклом, только пока он не ноль, так что
+  // объект, который уже уничтожается другим потоком, не воскресает.
+  shared_ptr<T, Refcount> lock() const noexcept {
+    if (cb == nullptr || !cb->inc_strong_if_alive()) {
+      return shared_ptr<T, Refcount>();
+    }
+    return shared_ptr<T, Refcount>::adopt(cb, ptr);
   }
 
   std::size_t use_count() const noexcept {
@@ -277,7 +347,96 @@ private:
   }
 };
 
-template <typename T, typename... Args>
-shared_ptr<T> make_shared(Args&&... args) {
-  return shared_ptr<T>(new detail::control_block_obj<T>(std::forward<Args>(args)...));
-}
+// Базовый класс для объектов, которым нужен shared_ptr на самих себя.
+// Встроенный weak_ptr привязывается к блоку управления, когда объект впервые
+// отдается во владение shared_ptr с политикой Refcount: make_shared,
+// allocate_shared или конструктором от сырого указателя. Привязка не выделяет
+// память и не вызывает виртуальных функций. shared_from_this до этого бросает
+// std::bad_weak_ptr, а weak_from_this возвращает пустой weak_ptr.
+template <typename T, typename Refcount>
+class enable_shared_from_this {
+  template <typename, typename>
+  friend class shared_ptr;
+
+public:
+  shared_ptr<T, Refcount> shared_from_this() {
+    return shared_ptr<T, Refcount>(weak_this);
+  }
+
+  shared_ptr<const T, Refcount> shared_from_this() const {
+    return shared_ptr<const T, Refcount>(weak_this);
+  }
+
+  weak_ptr<T, Refcount> weak_from_this() noexcept {
+    return weak_this;
+  }
+
+  weak_ptr<const T, Refcount> weak_from_this() const noexcept {
+    return weak_this;
+  }
+
+protected:
+  enable_shared_from_this() noexcept = default;
+
+  // Копия объекта -- другой объект, и владелец у нее свой.
+  enable_shared_from_this(const enable_shared_from_this&) noexcept {}
+
+  enable_shared_from_this& operator=(const enable_shared_from_this&) noexcept {
+    return *this;
+  }
+
+  ~enable_shared_from_this() = default;
+
+private:
+  // Объект, уже принадлежащий живому shared_ptr, не перепривязывается.
+  template <typename Y>
+  void attach(detail::control_block<Refcount>* cb, Y* raw) noexcept {
+    if (weak_this.use_count() != 0) {
+      return;
+    }
+    weak_this.reset();
+    cb->inc_weak();
+    weak_this.cb = cb;
+    weak_this.ptr = static_cast<T*>(const_cast<std::remove_cv_t<Y>*>(raw));
+  }
+
+  weak_ptr<T, Refcount> weak_this;
+};
+
+namespace detail {
+template <typename T, typename Refcount>
+struct allocate_shared_fn {
+  template <typename Alloc, typename... Args>
+  shared_ptr<T, Refcount> operator()(const Alloc& alloc, Args&&... args) const {
+    using block = control_block_obj<T, Refcount, Alloc>;
+    return shared_ptr<T, Refcount>(create_block<block>(alloc, std::forward<Args>(args)...));
+  }
+};
+
+template <typename T, typename Refcount>
+struct make_shared_fn {
+  template <typename... Args>
+  shared_ptr<T, Refcount> operator()(Args&&... args) const {
+    return allocate_shared_fn<T, Refcount>()(block_pool_allocator<T>(), std::forward<Args>(args)...);
+  }
+};
+} // namespace detail
+
+// Фабрики -- объекты, а не функции: вызов объекта не ищется по ADL, и
+// аргументы из std (std::allocator, std::string) не подтягивают
+// std::allocate_shared и std::make_shared в неоднозначную перегрузку.
+//
+//   auto text = allocate_shared<std::string>(std::allocator<char>(), "text");
+//   auto list = make_shared<std::vector<int>, local_refcount>(std::vector<int>{1, 2});
+
+// Создает объект вместе с блоком управления в памяти, выделенной через
+// alloc; копия alloc хранится в блоке и возвращает память, когда уходит
+// последняя ссылка. Сам объект конструируется placement new.
+template <typename T, typename Refcount = atomic_refcount>
+inline constexpr detail::allocate_shared_fn<T, Refcount> allocate_shared{};
+
+// make_shared<T, local_refcount>(args...) создает указатель с однопоточными
+// счетчиками. Блоки берутся из потоковых кешей block_pool_allocator, так что
+// в установившемся режиме make_shared не обращается к общей куче.
+template <typename T, typename Refcount = atomic_refcount>
+inline constexpr detail::make_shared_fn<T, Refcount> make_shared{};